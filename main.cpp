@@ -17,203 +17,3149 @@
 #include <vector>
 #include <unordered_map>
 #include <algorithm>
+#include <numeric>
+#include <cstdint>
+#include <random>
+#include <array>
+#include <memory>
+#include <bit>
+#include <thread>
+#include <fstream>
+#include <cerrno>
+#include <cstring>
+#include <climits>
+#include <string_view>
+#include <span>
+#include <filesystem>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdexcept>
+#include <exception>
+#include <memory_resource>
+#include <mutex>
+#include <condition_variable>
+#include <shared_mutex>
+#include <deque>
+#include <map>
+#include <iterator>
+#include <functional>
+#include <atomic>
+#include <cmath>
+#include <ranges>
+#include <utility>
+#include <type_traits>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
 
-typedef std::unordered_map<std::string, std::vector<double>> modelData;
+// Training counts stop at UINT32_MAX instead of wrapping
+inline uint32_t addCounts(const uint32_t a, const uint32_t b) {
+	return a > UINT32_MAX - b ? UINT32_MAX : a + b;
+}
 
-struct ExportedModel {
-	std::vector<char> alphabet;
-	std::vector<modelData> models;
+// Letters seen after a given context and how many times, in a single
+// allocation: the letters seen, in alphabet order, then their counts as
+// running totals, ready for sampling. The totals take 16 bits while they
+// fit and 32 bits beyond, counts summing past 32 bits are scaled down to
+// fit. The prior of every letter is added by the sampling.
+//
+// The buffer takes the memory resource of the map holding the chain.
+class Chain {
+public:
+	typedef std::pmr::polymorphic_allocator<> allocator_type;
+
+	Chain() = default;
+
+	explicit Chain(const allocator_type &allocator) : m_allocator(allocator) {
+	}
+
+	// like the pmr containers, a plain copy takes the default resource
+	Chain(const Chain &other) : Chain(other, allocator_type()) {
+	}
+
+	Chain(const Chain &other, const allocator_type &allocator) : m_allocator(allocator) {
+		copy(other);
+	}
+
+	Chain(Chain &&other) noexcept : m_allocator(other.m_allocator) {
+		take(other);
+	}
+
+	Chain(Chain &&other, const allocator_type &allocator) : m_allocator(allocator) {
+		if (m_allocator == other.m_allocator) {
+			take(other);
+		} else {
+			copy(other);
+		}
+	}
+
+	Chain &operator=(const Chain &other) {
+		if (this != &other) {
+			release();
+			copy(other);
+		}
+		return *this;
+	}
+
+	Chain &operator=(Chain &&other) {
+		if (this != &other) {
+			release();
+			if (m_allocator == other.m_allocator) {
+				take(other);
+			} else {
+				copy(other);
+			}
+		}
+		return *this;
+	}
+
+	~Chain() {
+		release();
+	}
+
+	inline allocator_type get_allocator() const {
+		return m_allocator;
+	}
+
+	// from the counts of every letter of the alphabet
+	void assign(const std::span<const uint32_t> counts) {
+		const uint64_t sum = std::accumulate(counts.begin(), counts.end(), uint64_t(0));
+		// every letter seen keeps at least 1, the margin leaves room for it
+		const double scale = sum > UINT32_MAX ? double(UINT32_MAX - 2 * counts.size()) / sum : 1.0;
+		const size_t size = counts.size() - std::count(counts.begin(), counts.end(), 0u);
+		const uint8_t width = sum <= UINT16_MAX ? sizeof(uint16_t) : sizeof(uint32_t);
+		uint8_t *data = allocate(size, width);
+
+		uint64_t total = 0;
+		for (size_t i = 0, j = 0; i < counts.size(); ++i) {
+			if (!counts[i]) {
+				continue;
+			}
+			total += scale < 1.0 ? std::max<uint32_t>(1, counts[i] * scale) : counts[i];
+			data[j] = i;
+			if (width == sizeof(uint16_t)) {
+				reinterpret_cast<uint16_t *>(data + offset(size, width))[j] = total;
+			} else {
+				reinterpret_cast<uint32_t *>(data + offset(size, width))[j] = total;
+			}
+			++j;
+		}
+		release();
+		m_data = data;
+		m_size = size;
+		m_width = width;
+	}
+
+	// letters seen
+	inline size_t size() const {
+		return m_size;
+	}
+
+	inline std::span<const uint8_t> letters() const {
+		return {m_data, m_size};
+	}
+
+	// the letters can be renamed as long as they keep their order
+	inline std::span<uint8_t> letters() {
+		return {m_data, m_size};
+	}
+
+	inline uint8_t letter(const size_t i) const {
+		return m_data[i];
+	}
+
+	// count of the letters seen up to i
+	inline uint32_t total(const size_t i) const {
+		return m_width == sizeof(uint16_t) ? narrow()[i] : wide()[i];
+	}
+
+	inline uint32_t sum() const {
+		return total(size() - 1);
+	}
+
+	inline uint32_t count(const size_t i) const {
+		return i ? total(i) - total(i - 1) : total(0);
+	}
+
+	inline size_t search(const double value) const {
+		return m_width == sizeof(uint16_t) ? std::upper_bound(narrow(), narrow() + m_size, value) - narrow()
+										   : std::upper_bound(wide(), wide() + m_size, value) - wide();
+	}
+
+	// counts of every letter of an alphabet of the given size
+	std::vector<uint32_t> counts(const size_t alphabet) const {
+		std::vector<uint32_t> res(alphabet);
+		for (size_t i = 0; i < size(); ++i) {
+			res[letter(i)] = count(i);
+		}
+		return res;
+	}
+
+private:
+	allocator_type m_allocator;
+	uint8_t *m_data = nullptr;
+	uint16_t m_size = 0;
+	// bytes of every total
+	uint8_t m_width = sizeof(uint16_t);
+
+	// the totals start after the letters, aligned to their width
+	static inline size_t offset(const size_t size, const size_t width) {
+		return (size + width - 1) / width * width;
+	}
+
+	static inline size_t bytes(const size_t size, const size_t width) {
+		return offset(size, width) + size * width;
+	}
+
+	uint8_t *allocate(const size_t size, const size_t width) {
+		if (!size) {
+			return nullptr;
+		}
+		return static_cast<uint8_t *>(m_allocator.allocate_bytes(bytes(size, width), alignof(uint32_t)));
+	}
+
+	void release() {
+		if (m_data) {
+			m_allocator.deallocate_bytes(m_data, bytes(m_size, m_width), alignof(uint32_t));
+		}
+		m_data = nullptr;
+		m_size = 0;
+	}
+
+	void copy(const Chain &other) {
+		m_data = allocate(other.m_size, other.m_width);
+		if (m_data) {
+			std::memcpy(m_data, other.m_data, bytes(other.m_size, other.m_width));
+		}
+		m_size = other.m_size;
+		m_width = other.m_width;
+	}
+
+	void take(Chain &other) {
+		m_data = std::exchange(other.m_data, nullptr);
+		m_size = std::exchange(other.m_size, 0);
+		m_width = other.m_width;
+	}
+
+	inline const uint16_t *narrow() const {
+		return reinterpret_cast<const uint16_t *>(m_data + offset(m_size, sizeof(uint16_t)));
+	}
+
+	inline const uint32_t *wide() const {
+		return reinterpret_cast<const uint32_t *>(m_data + offset(m_size, sizeof(uint32_t)));
+	}
+};
+
+typedef std::pmr::unordered_map<uint64_t, Chain> modelData;
+
+// A chain laid out in the arena of a FrozenModel, read like a Chain
+struct FrozenChain {
+	const uint8_t *letters;
+	const uint32_t *totals;
+	// Walker's alias table of the counts, null without Sampling::Alias
+	const double *aliasProb;
+	const uint8_t *alias;
+	// node reached after every letter
+	const uint32_t *next;
+	uint32_t n;
+
+	inline size_t size() const {
+		return n;
+	}
+
+	inline uint8_t letter(const size_t i) const {
+		return letters[i];
+	}
+
+	inline uint32_t sum() const {
+		return totals[n - 1];
+	}
+
+	inline size_t search(const double value) const {
+		return std::upper_bound(totals, totals + n, value) - totals;
+	}
+};
+
+// Minimal perfect hash of a fixed set of keys, BBHash style. Every level
+// is a bit array twice the size of the keys left: a key hashing alone to
+// a bit sets it, the others fall to the next level. The index of a key is
+// the rank of its bit, which takes about 3.3 bits per key. Other keys get
+// an arbitrary index, or none.
+class PerfectHash {
+public:
+	static constexpr size_t NONE = SIZE_MAX;
+
+	explicit PerfectHash(std::pmr::memory_resource *resource = std::pmr::get_default_resource()) :
+		m_size(0), m_bits(resource), m_levels(resource), m_ranks(resource), m_fallback(resource)
+	{
+	}
+
+	PerfectHash(std::vector<uint64_t> keys, std::pmr::memory_resource *resource) :
+		m_size(keys.size()), m_bits(resource), m_levels(resource), m_ranks(resource),
+		m_fallback(resource)
+	{
+		std::vector<uint64_t> seen, collided;
+		size_t placed = 0;
+
+		for (int level = 0; level < MAX_LEVELS && !keys.empty(); level++) {
+			const size_t words = (keys.size() * 2 + 63) / 64;
+			seen.assign(words, 0);
+			collided.assign(words, 0);
+
+			for (const uint64_t key : keys) {
+				const uint64_t bit = position(key, level, words * 64);
+				if (seen[bit / 64] & (UINT64_C(1) << (bit % 64))) {
+					collided[bit / 64] |= UINT64_C(1) << (bit % 64);
+				}
+				seen[bit / 64] |= UINT64_C(1) << (bit % 64);
+			}
+			for (size_t i = 0; i < words; ++i) {
+				seen[i] &= ~collided[i];
+			}
+			m_levels.push_back(m_bits.size() * 64);
+			m_bits.insert(m_bits.end(), seen.cbegin(), seen.cend());
+
+			size_t left = 0;
+			for (const uint64_t key : keys) {
+				const uint64_t bit = position(key, level, words * 64);
+				if (!(seen[bit / 64] & (UINT64_C(1) << (bit % 64)))) {
+					keys[left++] = key;
+				}
+			}
+			placed += keys.size() - left;
+			keys.resize(left);
+		}
+		m_levels.push_back(m_bits.size() * 64);
+
+		// set bits before every block of 8 words
+		size_t rank = 0;
+		for (size_t i = 0; i < m_bits.size(); ++i) {
+			if (i % 8 == 0) {
+				m_ranks.push_back(rank);
+			}
+			rank += std::popcount(m_bits[i]);
+		}
+		// the few keys that never hashed alone
+		for (const uint64_t key : keys) {
+			m_fallback.emplace(key, placed++);
+		}
+	}
+
+	inline size_t size() const {
+		return m_size;
+	}
+
+	size_t operator()(const uint64_t key) const {
+		for (size_t level = 0; level + 1 < m_levels.size(); level++) {
+			const uint64_t bit = m_levels[level]
+					+ position(key, level, m_levels[level + 1] - m_levels[level]);
+			const uint64_t word = m_bits[bit / 64];
+			if (word & (UINT64_C(1) << (bit % 64))) {
+				return rank(bit);
+			}
+		}
+		auto it = m_fallback.find(key);
+		return it == m_fallback.cend() ? NONE : it->second;
+	}
+
+private:
+	static const int MAX_LEVELS = 32;
+
+	size_t m_size;
+	// bits of every level, one after the other
+	std::pmr::vector<uint64_t> m_bits;
+	// first bit of every level, and the end of the last one
+	std::pmr::vector<uint64_t> m_levels;
+	std::pmr::vector<uint64_t> m_ranks;
+	std::pmr::unordered_map<uint64_t, size_t> m_fallback;
+
+	static inline uint64_t position(uint64_t key, const int level, const uint64_t bits) {
+		key ^= (level + 1) * UINT64_C(0x9e3779b97f4a7c15);
+		key = (key ^ (key >> 30)) * UINT64_C(0xbf58476d1ce4e5b9);
+		key = (key ^ (key >> 27)) * UINT64_C(0x94d049bb133111eb);
+		key ^= key >> 31;
+		return static_cast<uint64_t>((static_cast<unsigned __int128>(key) * bits) >> 64);
+	}
+
+	inline size_t rank(const uint64_t bit) const {
+		const size_t word = bit / 64;
+		size_t res = m_ranks[word / 8];
+		for (size_t i = word & ~size_t(7); i < word; ++i) {
+			res += std::popcount(m_bits[i]);
+		}
+		return res + std::popcount(m_bits[word] & ((UINT64_C(1) << (bit % 64)) - 1));
+	}
+};
+
+// How the contexts of a FrozenModel are found: an open addressing table
+// with the keys inline, or a minimal perfect hash with a fingerprint of
+// every key, several times smaller and with no probing.
+enum class ContextIndex {
+	OpenAddressing,
+	PerfectHash
+};
+
+// Read only copy of the models for generation. The chains of every order
+// are laid out one after the other in a single arena, and the contexts of
+// every order are indexed to find their chain in one or two cache lines.
+//
+// The contexts of all the orders also form a trie with suffix links: every
+// context is a node linked to the context one letter shorter, and every
+// letter seen after it leads to the longest context that ends with it.
+// Generation moves from node to node without any lookup, a letter that
+// wasn't seen after a context follows the suffix links down to the order
+// that saw it, which is the back-off of the hashed lookups.
+//
+// Everything is allocated from the memory resource given.
+class FrozenModel {
+public:
+	static constexpr uint32_t NONE = UINT32_MAX;
+
+	FrozenModel(const std::pmr::vector<modelData> &models, const bool alias,
+				const ContextIndex index, const int bits, const size_t alphabet,
+				const uint64_t padding, std::pmr::memory_resource *resource) :
+		m_index(index), m_tables(resource), m_perfect(resource), m_nodes(resource),
+		m_letters(resource), m_totals(resource), m_next(resource), m_aliasProb(resource),
+		m_alias(resource), m_rootNext(resource), m_start(NONE)
+	{
+		size_t letters = 0;
+		size_t nodes = 0;
+		for (const modelData &model : models) {
+			nodes += model.size();
+			for (const auto &it : model) {
+				letters += it.second.size();
+			}
+		}
+		m_letters.reserve(letters);
+		m_totals.reserve(letters);
+		m_next.reserve(letters);
+		m_nodes.reserve(nodes);
+		m_tables.reserve(models.size());
+		m_perfect.reserve(models.size());
+		if (alias) {
+			m_aliasProb.reserve(letters);
+			m_alias.reserve(letters);
+		}
+
+		std::vector<uint64_t> keys;
+		keys.reserve(nodes);
+		std::vector<uint32_t> firsts;
+		std::vector<Slot> slots;
+		AliasScratch scratch;
+		for (size_t order = 1; order <= models.size(); order++) {
+			firsts.push_back(m_nodes.size());
+			slots.clear();
+			for (const auto &it : models[order - 1]) {
+				const Chain &chain = it.second;
+				slots.push_back(Slot{it.first, static_cast<uint32_t>(m_nodes.size())});
+				keys.push_back(it.first);
+				m_nodes.push_back(Node{static_cast<uint32_t>(m_letters.size()),
+									   static_cast<uint32_t>(chain.size()), NONE});
+
+				m_letters.insert(m_letters.end(), chain.letters().begin(), chain.letters().end());
+				for (size_t i = 0; i < chain.size(); ++i) {
+					m_totals.push_back(chain.total(i));
+				}
+				if (alias) {
+					appendAlias(chain, scratch);
+				}
+			}
+			if (index == ContextIndex::PerfectHash) {
+				buildPerfect(slots, order * bits <= 32);
+			} else {
+				buildTable(slots);
+			}
+		}
+		linkNodes(keys, firsts, bits, alphabet, padding);
+	}
+
+	// Node of a context of the given order, NONE if it wasn't seen
+	inline uint32_t find(const int order, const uint64_t key) const {
+		if (m_index == ContextIndex::PerfectHash) {
+			const Perfect &perfect = m_perfect[order - 1];
+			const size_t i = perfect.hash(key);
+			if (i >= perfect.slots.size() || perfect.slots[i].fingerprint != fingerprint(perfect, key)) {
+				return NONE;
+			}
+			return perfect.slots[i].node;
+		}
+		const Table &table = m_tables[order - 1];
+		return table.slots[probe(table, key)].node;
+	}
+
+	inline FrozenChain chain(const uint32_t node) const {
+		const Node &n = m_nodes[node];
+		FrozenChain res;
+		res.letters = m_letters.data() + n.offset;
+		res.totals = m_totals.data() + n.offset;
+		res.aliasProb = m_aliasProb.empty() ? nullptr : m_aliasProb.data() + n.offset;
+		res.alias = m_alias.empty() ? nullptr : m_alias.data() + n.offset;
+		res.next = m_next.data() + n.offset;
+		res.n = n.size;
+		return res;
+	}
+
+	// node of the context every word starts with
+	inline uint32_t start() const {
+		return m_start;
+	}
+
+	// Start loading a node, then once it's there its chain, ahead of
+	// chain(node)
+	inline void prefetchNode(const uint32_t node) const {
+		__builtin_prefetch(m_nodes.data() + node);
+	}
+
+	inline void prefetchChain(const uint32_t node) const {
+		const Node &n = m_nodes[node];
+		__builtin_prefetch(m_letters.data() + n.offset);
+		__builtin_prefetch(m_totals.data() + n.offset);
+		__builtin_prefetch(m_next.data() + n.offset);
+	}
+
+	// Nodes, numbered from 0. A node comes after its suffix.
+	inline size_t size() const {
+		return m_nodes.size();
+	}
+
+	inline uint32_t suffix(const uint32_t node) const {
+		return m_nodes[node].suffix;
+	}
+
+	// Node after a letter that may not have been seen after the node
+	uint32_t next(uint32_t node, const uint8_t letter) const {
+		while (node != NONE) {
+			const Node &n = m_nodes[node];
+			const uint8_t *begin = m_letters.data() + n.offset;
+			const uint8_t *end = begin + n.size;
+			const uint8_t *it = std::lower_bound(begin, end, letter);
+			if (it != end && *it == letter) {
+				return m_next[it - m_letters.data()];
+			}
+			node = n.suffix;
+		}
+		return m_rootNext[letter];
+	}
+
+private:
+	struct Node {
+		uint32_t offset;
+		uint32_t size;
+		// context without its first letter, NONE for the first order
+		uint32_t suffix;
+	};
+
+	// empty while node is NONE
+	struct Slot {
+		uint64_t key = 0;
+		uint32_t node = NONE;
+	};
+
+	struct Table {
+		explicit Table(std::pmr::memory_resource *resource) : slots(resource) {
+		}
+
+		std::pmr::vector<Slot> slots;
+		size_t mask;
+		int shift;
+	};
+
+	struct PerfectSlot {
+		uint32_t fingerprint;
+		uint32_t node;
+	};
+
+	// Keys of 32 bits or less are their own fingerprint, so a context
+	// that wasn't seen is always rejected; longer keys keep 32 bits of a
+	// hash and collide once in 2^32 misses.
+	struct Perfect {
+		Perfect(std::vector<uint64_t> keys, const bool exact,
+				std::pmr::memory_resource *resource) :
+			hash(std::move(keys), resource), slots(resource), exact(exact)
+		{
+		}
+
+		PerfectHash hash;
+		std::pmr::vector<PerfectSlot> slots;
+		bool exact;
+	};
+
+	ContextIndex m_index;
+	std::pmr::vector<Table> m_tables;
+	std::pmr::vector<Perfect> m_perfect;
+	std::pmr::vector<Node> m_nodes;
+	// arena of the chains, one entry per letter seen after a context
+	std::pmr::vector<uint8_t> m_letters;
+	std::pmr::vector<uint32_t> m_totals;
+	std::pmr::vector<uint32_t> m_next;
+	std::pmr::vector<double> m_aliasProb;
+	std::pmr::vector<uint8_t> m_alias;
+	// node of every letter of the first order
+	std::pmr::vector<uint32_t> m_rootNext;
+	uint32_t m_start;
+
+	struct AliasScratch {
+		std::vector<uint32_t> small;
+		std::vector<uint32_t> large;
+		std::vector<double> scaled;
+	};
+
+	// Walker's alias table of a chain by Vose's method, after the others
+	void appendAlias(const Chain &chain, AliasScratch &scratch) {
+		const size_t n = chain.size();
+		const double total = chain.sum();
+		const size_t first = m_alias.size();
+		m_aliasProb.resize(first + n, 1.0);
+		m_alias.resize(first + n);
+		double *aliasProb = m_aliasProb.data() + first;
+		uint8_t *alias = m_alias.data() + first;
+		scratch.scaled.resize(n);
+		scratch.small.clear();
+		scratch.large.clear();
+
+		for (uint32_t i = 0; i < n; ++i) {
+			alias[i] = i;
+			scratch.scaled[i] = chain.count(i) * n / total;
+			if (scratch.scaled[i] < 1.0) {
+				scratch.small.push_back(i);
+			} else {
+				scratch.large.push_back(i);
+			}
+		}
+		while (!scratch.small.empty() && !scratch.large.empty()) {
+			const uint32_t less = scratch.small.back();
+			const uint32_t more = scratch.large.back();
+			scratch.small.pop_back();
+			aliasProb[less] = scratch.scaled[less];
+			alias[less] = more;
+			scratch.scaled[more] = (scratch.scaled[more] + scratch.scaled[less]) - 1.0;
+			if (scratch.scaled[more] < 1.0) {
+				scratch.large.pop_back();
+				scratch.small.push_back(more);
+			}
+		}
+	}
+
+	void buildTable(const std::vector<Slot> &slots) {
+		Table &table = m_tables.emplace_back(m_nodes.get_allocator().resource());
+		size_t capacity = 2;
+		table.shift = 63;
+		while (capacity < slots.size() * 2) {
+			capacity *= 2;
+			--table.shift;
+		}
+		table.slots.resize(capacity);
+		table.mask = capacity - 1;
+
+		for (const Slot &slot : slots) {
+			table.slots[probe(table, slot.key)] = slot;
+		}
+	}
+
+	void buildPerfect(const std::vector<Slot> &slots, const bool exact) {
+		std::vector<uint64_t> keys(slots.size());
+		for (size_t i = 0; i < slots.size(); ++i) {
+			keys[i] = slots[i].key;
+		}
+		Perfect &perfect = m_perfect.emplace_back(std::move(keys), exact,
+												  m_nodes.get_allocator().resource());
+		perfect.slots.resize(slots.size());
+
+		for (const Slot &slot : slots) {
+			perfect.slots[perfect.hash(slot.key)] =
+					PerfectSlot{fingerprint(perfect, slot.key), slot.node};
+		}
+	}
+
+	// `keys` holds the key of every node and `firsts` the first node of
+	// every order. After a letter the context grows by one, up to the
+	// highest order; it was always seen in training unless the letter ends
+	// the word.
+	void linkNodes(const std::vector<uint64_t> &keys, const std::vector<uint32_t> &firsts,
+				   const int bits, const size_t alphabet, const uint64_t padding)
+	{
+		const int orders = firsts.size();
+		auto mask = [bits](const int order) {
+			return order * bits >= 64 ? UINT64_MAX : (UINT64_C(1) << (order * bits)) - 1;
+		};
+		// longest context seen among the last letters of key
+		auto longest = [this, &mask](const uint64_t key, int order) {
+			uint32_t node = NONE;
+			for (; order > 0 && node == NONE; order--) {
+				node = find(order, key & mask(order));
+			}
+			return node;
+		};
+
+		m_next.resize(m_letters.size(), NONE);
+		for (int order = 1; order <= orders; order++) {
+			const uint32_t last = order < orders ? firsts[order] : m_nodes.size();
+			for (uint32_t node = firsts[order - 1]; node < last; ++node) {
+				Node &n = m_nodes[node];
+				if (order > 1) {
+					n.suffix = find(order - 1, keys[node] & mask(order - 1));
+				}
+				for (uint32_t i = n.offset; i < n.offset + n.size; ++i) {
+					if (m_letters[i] != padding) {
+						m_next[i] = longest((keys[node] << bits) | m_letters[i],
+											std::min(order + 1, orders));
+					}
+				}
+			}
+		}
+
+		m_rootNext.assign(alphabet, NONE);
+		for (size_t letter = 0; letter < alphabet; ++letter) {
+			m_rootNext[letter] = find(1, letter);
+		}
+		uint64_t start = 0;
+		for (int i = 0; i < orders; i++) {
+			start = (start << bits) | padding;
+		}
+		m_start = longest(start, orders);
+	}
+
+	static inline uint32_t fingerprint(const Perfect &perfect, const uint64_t key) {
+		if (perfect.exact) {
+			return static_cast<uint32_t>(key);
+		}
+		return static_cast<uint32_t>((key * UINT64_C(0xd6e8feb86659fd93)) >> 32);
+	}
+
+	// slot holding the key, or the empty one where it would go
+	static inline size_t probe(const Table &table, const uint64_t key) {
+		size_t i = (key * UINT64_C(0x9e3779b97f4a7c15)) >> table.shift;
+		while (table.slots[i].node != NONE && table.slots[i].key != key) {
+			i = (i + 1) & table.mask;
+		}
+		return i;
+	}
+};
+
+// Rolling window over the last letters of the word being generated, padded
+// with '#' at the start. Letters are stored as alphabet indices packed
+// `bits` apiece into one integer, which is the key of the models; the key
+// of a lower order is the low bits of the same integer.
+class Context {
+public:
+	Context(const int order, const int bits, const uint64_t padding) :
+		m_order(order), m_bits(bits), m_key(0), m_node(UINT32_MAX)
+	{
+		for (int i = 0; i < order; i++) {
+			push(padding);
+		}
+	}
+
+	inline void push(const uint64_t index) {
+		m_key = ((m_key << m_bits) | index) & mask(m_order);
+	}
+
+	// key of the last n letters
+	inline uint64_t last(const int n) const {
+		return m_key & mask(n);
+	}
+
+	// node of a frozen model's trie matching the context
+	inline uint32_t node() const {
+		return m_node;
+	}
+
+	inline void setNode(const uint32_t node) {
+		m_node = node;
+	}
+
+private:
+	int m_order;
+	int m_bits;
+	uint64_t m_key;
+	uint32_t m_node;
+
+	inline uint64_t mask(const int n) const {
+		return n * m_bits >= 64 ? UINT64_MAX : (UINT64_C(1) << (n * m_bits)) - 1;
+	}
+};
+
+// How the next letter is drawn from a chain: a binary search over the
+// cumulative totals or a constant time lookup in an alias table. The alias
+// tables are laid out in the frozen copy of the model, which Alias freezes.
+enum class Sampling {
+	Cumulative,
+	Alias
 };
 
-class Model {
-public:
-	Model(const std::vector<std::string> &trainData,
-		  const int order, double dPrior) :
-		m_dPrior(dPrior), m_order(order), m_models(order)
+// xoshiro256** generator (http://prng.di.unimi.it), small and seedable.
+// It keeps no shared state, every thread generating words needs its own,
+// split() hands out independent streams of the same seed.
+class Random {
+public:
+	typedef uint64_t result_type;
+
+	Random() {
+		std::random_device device;
+		seed((static_cast<uint64_t>(device()) << 32) | device());
+	}
+
+	explicit Random(const uint64_t value) {
+		seed(value);
+	}
+
+	// splitmix64 expands the seed into the whole state
+	void seed(uint64_t value) {
+		for (uint64_t &s : m_state) {
+			uint64_t z = (value += 0x9e3779b97f4a7c15);
+			z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+			z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+			s = z ^ (z >> 31);
+		}
+	}
+
+	uint64_t operator()() {
+		const uint64_t res = rotl(m_state[1] * 5, 7) * 9;
+		const uint64_t t = m_state[1] << 17;
+
+		m_state[2] ^= m_state[0];
+		m_state[3] ^= m_state[1];
+		m_state[1] ^= m_state[2];
+		m_state[0] ^= m_state[3];
+		m_state[2] ^= t;
+		m_state[3] = rotl(m_state[3], 45);
+		return res;
+	}
+
+	// uniform double in [0, 1)
+	inline double uniform() {
+		return ((*this)() >> 11) * 0x1.0p-53;
+	}
+
+	// Return a generator for the current stream and move this one 2^128
+	// steps ahead, so both can be used without overlapping.
+	Random split() {
+		Random res(*this);
+		jump();
+		return res;
+	}
+
+	static constexpr uint64_t min() {
+		return 0;
+	}
+	static constexpr uint64_t max() {
+		return UINT64_MAX;
+	}
+
+private:
+	uint64_t m_state[4];
+
+	static inline uint64_t rotl(const uint64_t x, int k) {
+		return (x << k) | (x >> (64 - k));
+	}
+
+	void jump() {
+		static const uint64_t JUMP[] = { 0x180ec6d33cfd0aba, 0xd5a61266f0c9392c,
+										 0xa9582618e03fc9aa, 0x39abdc4529b1661c };
+		uint64_t s[4] = { 0, 0, 0, 0 };
+		for (const uint64_t jump : JUMP) {
+			for (int b = 0; b < 64; b++) {
+				if (jump & UINT64_C(1) << b) {
+					for (int i = 0; i < 4; i++) {
+						s[i] ^= m_state[i];
+					}
+				}
+				(*this)();
+			}
+		}
+		std::copy(s, s + 4, m_state);
+	}
+};
+
+// Probability of a word ending with a length in [minLength, maxLength],
+// for every node of a FrozenModel and every length the word may have when
+// it gets there. Letters are then drawn in proportion to their weight and
+// the probability of the words they lead to, which is drawing from the
+// words of the window with no rejection.
+//
+// The table takes (maxLength + 1) doubles per node and is built in
+// O(maxLength * letters of the arena) time, so Model only builds it for
+// windows too few free draws fall in, see Model::windowTable().
+class LengthTable {
+public:
+	LengthTable(std::shared_ptr<const FrozenModel> frozen, const int minLength,
+				const int maxLength, const double prior, const size_t alphabet,
+				const uint64_t padding) :
+		m_frozen(std::move(frozen)), m_minLength(minLength), m_maxLength(maxLength),
+		m_prior(prior), m_alphabet(alphabet), m_padding(padding),
+		m_width(m_frozen->size() + 1),
+		m_probability((static_cast<size_t>(maxLength) + 1) * m_width)
+	{
+		build();
+	}
+
+	// Bytes of the table of a window on a model of that many contexts
+	static inline size_t bytes(const int maxLength, const size_t contexts) {
+		return (static_cast<size_t>(maxLength) + 1) * (contexts + 1) * sizeof(double);
+	}
+
+	inline size_t bytes() const {
+		return m_probability.size() * sizeof(double);
+	}
+
+	// No word of the model has a length in the window
+	inline bool empty() const {
+		return probability(0, m_frozen->start()) <= 0.0;
+	}
+
+	inline uint32_t start() const {
+		return m_frozen->start();
+	}
+
+	inline const FrozenModel &frozen() const {
+		return *m_frozen;
+	}
+
+	// Some word of the window goes through the node at that length
+	inline bool possible(const uint32_t node, const int length) const {
+		return length <= m_maxLength && probability(length, node) > 0.0;
+	}
+
+	// Draw the letter after a word of the given length that reached the
+	// node, and move to the next node. Returns the padding at the end.
+	size_t next(uint32_t &node, const int length, Random &random) const {
+		if (node == FrozenModel::NONE || length >= m_maxLength) {
+			return m_padding;
+		}
+		const FrozenChain chain = m_frozen->chain(node);
+		const double end = inWindow(length);
+		const double *after = row(length + 1);
+
+		// weight of the node, which the letters seen and the prior add up to
+		double value = random.uniform() * probability(length, node)
+				* (chain.sum() + m_prior * m_alphabet);
+
+		double seen;
+		const uint32_t i = selectSeen(chain, end, after, value, seen);
+		if (i < chain.n) {
+			node = chain.letters[i] == m_padding ? FrozenModel::NONE : chain.next[i];
+			return chain.letters[i];
+		}
+		value -= seen;
+
+		size_t res = m_padding;
+		uint32_t to = FrozenModel::NONE;
+		for (uint32_t j = chain.n; j > 0; --j) {
+			if (count(chain, j - 1) * weight(chain, j - 1, end, after) > 0.0) {
+				res = chain.letters[j - 1];
+				to = res == m_padding ? FrozenModel::NONE : chain.next[j - 1];
+				break;
+			}
+		}
+		// the prior, spread over the whole alphabet
+		for (size_t letter = 0; letter < m_alphabet && m_prior > 0.0; ++letter) {
+			const uint32_t next = letter == m_padding ? FrozenModel::NONE
+													  : m_frozen->next(node, letter);
+			const double w = m_prior * (letter == m_padding ? end : after[column(next)]);
+			if (w > 0.0) {
+				res = letter;
+				to = next;
+				if (value < w) {
+					break;
+				}
+			}
+			value -= w;
+		}
+		// rounding may leave a sliver past the last letter, which takes it
+		node = to;
+		return res;
+	}
+
+	struct Branch {
+		// of the letter after the node
+		double probability;
+		// of ending in the window after it
+		double ahead;
+		uint32_t next;
+	};
+
+	// The words of the window through a node that isn't NONE, at that
+	// length, split by the letter after it, one branch per letter of the
+	// alphabet. The padding ends the word.
+	void branches(const uint32_t node, const int length, std::vector<Branch> &res) const {
+		const FrozenChain chain = m_frozen->chain(node);
+		const double total = chain.sum() + m_prior * m_alphabet;
+		res.assign(m_alphabet, Branch{m_prior / total, 0.0, FrozenModel::NONE});
+		for (uint32_t i = 0; i < chain.n; ++i) {
+			res[chain.letters[i]].probability += count(chain, i) / total;
+		}
+		for (size_t letter = 0; letter < m_alphabet; ++letter) {
+			Branch &branch = res[letter];
+			if (letter == m_padding) {
+				branch.ahead = inWindow(length);
+			} else if (branch.probability > 0.0 && length < m_maxLength) {
+				branch.next = m_frozen->next(node, letter);
+				branch.ahead = probability(length + 1, branch.next);
+			}
+		}
+	}
+
+	inline uint64_t padding() const {
+		return m_padding;
+	}
+
+private:
+	std::shared_ptr<const FrozenModel> m_frozen;
+	int m_minLength;
+	int m_maxLength;
+	double m_prior;
+	size_t m_alphabet;
+	uint64_t m_padding;
+	// nodes, and a last column for NONE, where the word ends
+	size_t m_width;
+	// probability of ending in the window, one row per length
+	std::vector<double> m_probability;
+
+	inline double inWindow(const int length) const {
+		return length >= m_minLength && length <= m_maxLength ? 1.0 : 0.0;
+	}
+
+	inline size_t column(const uint32_t node) const {
+		return node == FrozenModel::NONE ? m_width - 1 : node;
+	}
+
+	inline const double *row(const int length) const {
+		return m_probability.data() + length * m_width;
+	}
+
+	inline double probability(const int length, const uint32_t node) const {
+		return row(length)[column(node)];
+	}
+
+	static inline uint32_t count(const FrozenChain &chain, const uint32_t i) {
+		return i ? chain.totals[i] - chain.totals[i - 1] : chain.totals[0];
+	}
+
+	// probability of the window after the i-th letter of the chain
+	inline double weight(const FrozenChain &chain, const uint32_t i, const double end,
+						 const double *after) const
+	{
+		return chain.letters[i] == m_padding ? end : after[column(chain.next[i])];
+	}
+
+	// Position of the letter seen the value falls on: the number of running
+	// sums of the weights up to it, counted without a branch. chain.n if
+	// it falls past them, in the prior; `seen` gets their sum. With AVX2
+	// four letters are weighed and compared at once.
+	inline uint32_t selectSeen(const FrozenChain &chain, const double end, const double *after,
+							   const double value, double &seen) const
+	{
+		uint32_t i = 0;
+		uint32_t below = 0;
+		double sum = 0.0;
+#if defined(__AVX2__)
+		const __m256d limit = _mm256_set1_pd(value);
+		const __m256d ends = _mm256_set1_pd(end);
+		const __m256d zero = _mm256_setzero_pd();
+		const __m128i padding = _mm_set1_epi32(m_padding);
+		const __m128i last = _mm_set1_epi32(m_width - 1);
+		__m256d carry = zero;
+		uint32_t previous = 0;
+		for (; i + 4 <= chain.n; i += 4) {
+			const __m128i totals = _mm_loadu_si128(reinterpret_cast<const __m128i *>(chain.totals + i));
+			const __m128i before = _mm_alignr_epi8(totals, _mm_set1_epi32(previous), 12);
+			const __m256d counts = _mm256_cvtepi32_pd(_mm_sub_epi32(totals, before));
+
+			const __m128i next = _mm_loadu_si128(reinterpret_cast<const __m128i *>(chain.next + i));
+			// the masked gather, with every lane on, takes a source where
+			// the plain one leaves an undefined register GCC warns about
+			const __m256d ahead = _mm256_mask_i32gather_pd(zero, after, _mm_min_epu32(next, last),
+					_mm256_castsi256_pd(_mm256_set1_epi64x(-1)), 8);
+			int32_t letters;
+			std::memcpy(&letters, chain.letters + i, sizeof(letters));
+			const __m128i ending = _mm_cmpeq_epi32(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(letters)),
+												   padding);
+			const __m256d weights = _mm256_blendv_pd(ahead, ends,
+					_mm256_castsi256_pd(_mm256_cvtepi32_epi64(ending)));
+
+			// running sums of the four
+			__m256d sums = _mm256_mul_pd(counts, weights);
+			sums = _mm256_add_pd(sums, _mm256_blend_pd(
+					_mm256_permute4x64_pd(sums, _MM_SHUFFLE(2, 1, 0, 0)), zero, 0x1));
+			sums = _mm256_add_pd(sums, _mm256_blend_pd(
+					_mm256_permute4x64_pd(sums, _MM_SHUFFLE(1, 0, 0, 0)), zero, 0x3));
+			sums = _mm256_add_pd(sums, carry);
+
+			below += std::popcount(static_cast<unsigned>(
+					_mm256_movemask_pd(_mm256_cmp_pd(sums, limit, _CMP_LE_OQ))));
+			carry = _mm256_permute4x64_pd(sums, _MM_SHUFFLE(3, 3, 3, 3));
+			previous = chain.totals[i + 3];
+		}
+		sum = _mm256_cvtsd_f64(carry);
+#endif
+		for (; i < chain.n; ++i) {
+			sum += count(chain, i) * weight(chain, i, end, after);
+			below += sum <= value;
+		}
+		seen = sum;
+		return below;
+	}
+
+	// From the longest length down. A letter that wasn't seen after a node
+	// leads where it leads from its suffix, so the sum over the alphabet
+	// for the prior is the sum of the suffix corrected by the letters seen.
+	void build() {
+		const FrozenModel &frozen = *m_frozen;
+		const size_t nodes = frozen.size();
+		const bool prior = m_prior > 0.0;
+
+		// node after every letter seen, from the suffix of its node
+		std::vector<uint32_t> fromSuffix;
+		std::vector<double> sums;
+		if (prior) {
+			sums.resize(nodes);
+			for (uint32_t node = 0; node < nodes; ++node) {
+				const FrozenChain chain = frozen.chain(node);
+				for (uint32_t i = 0; i < chain.n; ++i) {
+					fromSuffix.push_back(chain.letters[i] == m_padding ? FrozenModel::NONE
+										 : frozen.next(frozen.suffix(node), chain.letters[i]));
+				}
+			}
+		}
+
+		for (int length = m_maxLength; length >= 0; length--) {
+			double *current = m_probability.data() + length * m_width;
+			const double end = inWindow(length);
+			current[m_width - 1] = end;
+
+			if (length == m_maxLength) {
+				for (uint32_t node = 0; node < nodes; ++node) {
+					const FrozenChain chain = frozen.chain(node);
+					double ends = m_prior;
+					const uint8_t *it = std::lower_bound(chain.letters, chain.letters + chain.n,
+														 m_padding);
+					if (it != chain.letters + chain.n && *it == m_padding) {
+						ends += count(chain, it - chain.letters);
+					}
+					current[node] = ends / (chain.sum() + m_prior * m_alphabet) * end;
+				}
+				continue;
+			}
+
+			const double *after = row(length + 1);
+			double rootSum = 0.0;
+			if (prior) {
+				for (size_t letter = 0; letter < m_alphabet; ++letter) {
+					if (letter != m_padding) {
+						rootSum += after[column(frozen.next(FrozenModel::NONE, letter))];
+					}
+				}
+			}
+			size_t entry = 0;
+			for (uint32_t node = 0; node < nodes; ++node) {
+				const FrozenChain chain = frozen.chain(node);
+				double seen = 0.0;
+				double correction = 0.0;
+				for (uint32_t i = 0; i < chain.n; ++i, ++entry) {
+					const double w = weight(chain, i, end, after);
+					seen += count(chain, i) * w;
+					if (prior && chain.letters[i] != m_padding) {
+						correction += w - after[column(fromSuffix[entry])];
+					}
+				}
+				double total = seen;
+				if (prior) {
+					const uint32_t suffix = frozen.suffix(node);
+					sums[node] = std::max(0.0, (suffix == FrozenModel::NONE ? rootSum : sums[suffix])
+											   + correction);
+					total += m_prior * (sums[node] + end);
+				}
+				current[node] = total / (chain.sum() + m_prior * m_alphabet);
+			}
+		}
+	}
+};
+
+// Words of the window of a LengthTable drawn without replacement, by
+// their probabilities. A trie of the words taken keeps what is left after
+// every prefix, summed again rather than subtracted so that rounding never
+// empties a prefix before all its words are taken.
+class DistinctDraws {
+public:
+	explicit DistinctDraws(const LengthTable &table) : m_table(table) {
+		m_left.push_back(table.empty() ? 0.0 : weigh(0, table.start(), 0));
+	}
+
+	// Take a word, as the letters of the alphabet it's made of. False if it
+	// was taken already or isn't in the window.
+	bool take(const std::vector<uint8_t> &word) {
+		clearPath();
+		uint32_t node = m_table.start();
+		size_t i = 0;
+		for (; node != FrozenModel::NONE && i <= word.size(); ++i) {
+			const size_t letter = i < word.size() ? word[i] : m_table.padding();
+			weigh(m_path.back(), node, i);
+			if (m_weights[letter] <= 0.0) {
+				return false;
+			}
+			node = step(letter);
+		}
+		if (i < word.size() || m_left[m_path.back()] <= 0.0) {
+			return false;
+		}
+		settle();
+		return true;
+	}
+
+	// Draw a word that wasn't taken and take it. False once the window has
+	// none left.
+	bool draw(std::vector<uint8_t> &word, Random &random) {
+		while (true) {
+			word.clear();
+			clearPath();
+			uint32_t node = m_table.start();
+			for (int length = 0; node != FrozenModel::NONE; ++length) {
+				const double left = weigh(m_path.back(), node, length);
+				if (left <= 0.0) {
+					break;
+				}
+				double value = random.uniform() * left;
+				size_t letter = 0;
+				for (size_t i = 0; i < m_weights.size(); ++i) {
+					if (m_weights[i] > 0.0) {
+						letter = i;
+						if (value < m_weights[i]) {
+							break;
+						}
+					}
+					value -= m_weights[i];
+				}
+				node = step(letter);
+				if (letter != m_table.padding()) {
+					word.push_back(letter);
+				}
+			}
+			if (node == FrozenModel::NONE) {
+				settle();
+				return true;
+			}
+			// what the node was given was rounding, it has nothing left
+			if (m_path.size() == 1) {
+				return false;
+			}
+			settle();
+		}
+	}
+
+private:
+	const LengthTable &m_table;
+	// trie node of every letter after a trie node, by node << 8 | letter
+	std::unordered_map<uint64_t, uint32_t> m_children;
+	// probability of the words left after every trie node, root first
+	std::vector<double> m_left;
+	// trie nodes of the word being taken and, for every letter of it, its
+	// probability and what is left after the other letters
+	std::vector<uint32_t> m_path;
+	std::vector<double> m_steps;
+	std::vector<double> m_rest;
+	std::vector<LengthTable::Branch> m_branches;
+	std::vector<double> m_weights;
+
+	// Weight of every letter after a trie node, what is left after it times
+	// its probability, and their sum
+	double weigh(const uint32_t trie, const uint32_t node, const int length) {
+		m_table.branches(node, length, m_branches);
+		m_weights.resize(m_branches.size());
+		double res = 0.0;
+		for (size_t letter = 0; letter < m_branches.size(); ++letter) {
+			const LengthTable::Branch &branch = m_branches[letter];
+			auto it = m_children.find(key(trie, letter));
+			m_weights[letter] = branch.probability
+					* (it == m_children.cend() ? branch.ahead : m_left[it->second]);
+			res += m_weights[letter];
+		}
+		return res;
+	}
+
+	static inline uint64_t key(const uint32_t trie, const size_t letter) {
+		return (static_cast<uint64_t>(trie) << 8) | letter;
+	}
+
+	inline void clearPath() {
+		m_path.assign(1, 0);
+		m_steps.clear();
+		m_rest.clear();
+	}
+
+	// Follow a letter weighed by weigh(), from the last node of the path
+	uint32_t step(const size_t letter) {
+		double rest = 0.0;
+		for (size_t i = 0; i < m_weights.size(); ++i) {
+			rest += i == letter ? 0.0 : m_weights[i];
+		}
+		const LengthTable::Branch &branch = m_branches[letter];
+		auto it = m_children.try_emplace(key(m_path.back(), letter), m_left.size()).first;
+		if (it->second == m_left.size()) {
+			m_left.push_back(branch.ahead);
+		}
+		m_path.push_back(it->second);
+		m_steps.push_back(branch.probability);
+		m_rest.push_back(rest);
+		return branch.next;
+	}
+
+	// Leave nothing after the last node of the path, and sum what is left
+	// after the nodes before it again
+	void settle() {
+		m_left[m_path.back()] = 0.0;
+		for (size_t i = m_steps.size(); i > 0; --i) {
+			m_left[m_path[i - 1]] = m_rest[i - 1] + m_steps[i - 1] * m_left[m_path[i]];
+		}
+	}
+};
+
+// Reads the lines of a file descriptor through a fixed buffer
+class FdLineReader {
+public:
+	explicit FdLineReader(const int fd) : m_fd(fd), m_begin(0), m_end(0) {
+	}
+
+	bool next(std::string &line) {
+		line.clear();
+		while (true) {
+			const char *begin = m_buffer + m_begin;
+			const char *end = m_buffer + m_end;
+			const char *newline = static_cast<const char *>(std::memchr(begin, '\n', end - begin));
+
+			if (newline) {
+				line.append(begin, newline);
+				m_begin = newline - m_buffer + 1;
+				return true;
+			}
+			line.append(begin, end);
+			m_begin = m_end = 0;
+
+			const ssize_t n = ::read(m_fd, m_buffer, sizeof(m_buffer));
+			if (n < 0 && errno == EINTR) {
+				continue;
+			} else if (n < 0) {
+				throw std::runtime_error(std::string("read failed: ") + std::strerror(errno));
+			} else if (n == 0) {
+				return !line.empty();
+			}
+			m_end = n;
+		}
+	}
+
+private:
+	int m_fd;
+	size_t m_begin;
+	size_t m_end;
+	char m_buffer[1 << 16];
+};
+
+// Non empty lines of a text as string_views into it, without copying
+class LineRange {
+public:
+	class iterator {
+	public:
+		iterator(const char *next, const char *end) : m_next(next), m_end(end) {
+			++*this;
+		}
+
+		inline std::string_view operator*() const {
+			return m_line;
+		}
+
+		iterator& operator++() {
+			while (m_next < m_end) {
+				const char *newline = static_cast<const char *>(
+							std::memchr(m_next, '\n', m_end - m_next));
+				const char *lineEnd = newline ? newline : m_end;
+				m_line = std::string_view(m_next, lineEnd - m_next);
+				m_next = newline ? newline + 1 : m_end;
+
+				if (!m_line.empty() && m_line.back() == '\r') {
+					m_line.remove_suffix(1);
+				}
+				if (!m_line.empty()) {
+					return *this;
+				}
+			}
+			m_line = std::string_view();
+			return *this;
+		}
+
+		inline bool operator!=(const iterator &other) const {
+			return m_line.data() != other.m_line.data();
+		}
+
+	private:
+		const char *m_next;
+		const char *m_end;
+		std::string_view m_line;
+	};
+
+	explicit LineRange(const std::string_view text) : m_text(text) {
+	}
+
+	inline iterator begin() const {
+		return iterator(m_text.data(), m_text.data() + m_text.size());
+	}
+
+	inline iterator end() const {
+		return iterator(m_text.data() + m_text.size(), m_text.data() + m_text.size());
+	}
+
+	// bytes of text
+	inline size_t size() const {
+		return m_text.size();
+	}
+
+	// Split in n consecutive ranges cut after a newline
+	std::vector<LineRange> split(const size_t n) const {
+		std::vector<LineRange> res;
+		size_t begin = 0;
+		for (size_t i = 1; i <= n; i++) {
+			size_t end = std::max(begin, m_text.size() * i / n);
+			if (end < m_text.size()) {
+				const size_t newline = m_text.find('\n', end);
+				end = newline == std::string_view::npos ? m_text.size() : newline + 1;
+			}
+			res.emplace_back(m_text.substr(begin, end - begin));
+			begin = end;
+		}
+		return res;
+	}
+
+private:
+	std::string_view m_text;
+};
+
+// Newline separated words of a file mapped in memory. Training reads the
+// words in place, from the page cache to the counts without any copy.
+class MappedCorpus {
+public:
+	explicit MappedCorpus(const std::string &path) : m_data(nullptr), m_size(0) {
+		const int fd = ::open(path.c_str(), O_RDONLY);
+		if (fd < 0) {
+			throw std::runtime_error("can't open " + path + ": " + std::strerror(errno));
+		}
+		struct stat info;
+		if (::fstat(fd, &info) < 0) {
+			::close(fd);
+			throw std::runtime_error("can't stat " + path + ": " + std::strerror(errno));
+		}
+		m_size = info.st_size;
+		if (m_size > 0) {
+			void *data = ::mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (data == MAP_FAILED) {
+				::close(fd);
+				throw std::runtime_error("can't map " + path + ": " + std::strerror(errno));
+			}
+			::madvise(data, m_size, MADV_SEQUENTIAL);
+			m_data = static_cast<const char *>(data);
+		}
+		::close(fd);
+	}
+
+	MappedCorpus(MappedCorpus &&other) : m_data(other.m_data), m_size(other.m_size) {
+		other.m_data = nullptr;
+		other.m_size = 0;
+	}
+
+	MappedCorpus(const MappedCorpus &) = delete;
+	MappedCorpus& operator=(const MappedCorpus &) = delete;
+
+	~MappedCorpus() {
+		if (m_data) {
+			::munmap(const_cast<char *>(m_data), m_size);
+		}
+	}
+
+	inline size_t size() const {
+		return m_size;
+	}
+
+	inline LineRange lines() const {
+		return LineRange(std::string_view(m_data, m_size));
+	}
+
+private:
+	const char *m_data;
+	size_t m_size;
+};
+
+// Words packed one after the other in a single buffer, with the offset
+// where every word starts. Once a reused batch has grown to its largest
+// size it stops allocating.
+class WordBatch {
+public:
+	WordBatch() : m_offsets(1, 0) {
+	}
+
+	inline size_t size() const {
+		return m_offsets.size() - 1;
+	}
+
+	inline bool empty() const {
+		return size() == 0;
+	}
+
+	inline std::string_view operator[](const size_t i) const {
+		return std::string_view(m_chars).substr(m_offsets[i], m_offsets[i + 1] - m_offsets[i]);
+	}
+
+	// every word back to back, with no separator
+	inline const std::string &chars() const {
+		return m_chars;
+	}
+
+	// where every word starts, and where the last one ends
+	inline const std::vector<size_t> &offsets() const {
+		return m_offsets;
+	}
+
+	void reserve(const size_t words, const size_t chars = 0) {
+		m_offsets.reserve(words + 1);
+		m_chars.reserve(chars);
+	}
+
+	void clear() {
+		m_chars.clear();
+		m_offsets.resize(1);
+	}
+
+	void push_back(const std::string_view word) {
+		m_chars.append(word);
+		m_offsets.push_back(m_chars.size());
+	}
+
+	void pop_back() {
+		m_offsets.pop_back();
+		m_chars.resize(m_offsets.back());
+	}
+
+private:
+	std::string m_chars;
+	std::vector<size_t> m_offsets;
+};
+
+struct ExportedModel {
+	std::vector<char> alphabet;
+	std::vector<modelData> models;
+	double prior = 0.0;
+};
+
+// The chains and the frozen copy of a model are allocated from the memory
+// resource given, the heap by default. With a monotonic_buffer_resource
+// the model lies in a few blocks and tearing it down frees nothing but
+// them; retraining a model on one only adds blocks, it's meant to hold
+// one model and be dropped with it. The resource must outlive the model,
+// copies of it allocate from the default resource: a frozen model is laid
+// out again for the copy, nothing of the resource is shared.
+class Model {
+public:
+	// Longest word generated, longer maxLength are taken as it
+	static constexpr int MAX_WORD_LENGTH = 1 << 10;
+
+	Model(const std::vector<std::string> &trainData,
+		  const int order, double dPrior,
+		  std::pmr::memory_resource *resource = std::pmr::get_default_resource()) :
+		m_order(0), m_bits(1), m_models(resource)
+	{
+		p_train(shardWords(trainData), order, dPrior);
+	}
+
+	Model(const ExportedModel &model,
+		  std::pmr::memory_resource *resource = std::pmr::get_default_resource()) :
+		m_dPrior(model.prior),
+		m_order(model.models.size()),
+		m_alphabet(model.alphabet),
+		m_models(model.models.cbegin(), model.models.cend(), resource)
+	{
+		buildIndex();
+	}
+
+	explicit Model(std::pmr::memory_resource *resource = std::pmr::get_default_resource()) :
+		m_models(resource)
+	{
+	}
+
+	Model(const Model &other) : m_models(std::pmr::get_default_resource()) {
+		*this = other;
+	}
+
+	// The models and the frozen copy keep the resource they were made in
+	Model(Model &&other) = default;
+
+	// The chains are copied into the resource of this model
+	Model &operator=(const Model &other) {
+		if (this == &other) {
+			return *this;
+		}
+		m_dPrior = other.m_dPrior;
+		m_order = other.m_order;
+		m_sampling = other.m_sampling;
+		m_threads = other.m_threads;
+		m_contextIndex = other.m_contextIndex;
+		m_stayFrozen = other.m_stayFrozen;
+		m_alphabet = other.m_alphabet;
+		m_index = other.m_index;
+		m_bits = other.m_bits;
+		m_padding = other.m_padding;
+		m_models = other.m_models;
+		m_frozen.reset();
+		m_lengths.clear();
+		if (other.m_frozen) {
+			m_frozen = newFrozen(m_sampling == Sampling::Alias, m_contextIndex);
+		}
+		return *this;
+	}
+
+	// The exported chains are allocated from the default resource
+	ExportedModel exportData() const {
+		ExportedModel res{m_alphabet, {m_models.cbegin(), m_models.cend()}, m_dPrior};
+		return res;
+	}
+
+	inline std::pmr::memory_resource *resource() const {
+		return m_models.get_allocator().resource();
+	}
+
+	inline int order() const {
+		return m_order;
+	}
+
+	inline bool isTrained() const {
+		return !m_models.empty();
+	}
+
+	// contexts of every order, the nodes of a frozen copy
+	size_t contexts() const {
+		size_t res = 0;
+		for (const modelData &model : m_models) {
+			res += model.size();
+		}
+		return res;
+	}
+
+	inline Sampling sampling() const {
+		return m_sampling;
+	}
+
+	void setSampling(const Sampling sampling) {
+		m_sampling = sampling;
+		buildSamplingTables();
+	}
+
+	inline bool isFrozen() const {
+		return static_cast<bool>(m_frozen);
+	}
+
+	// Lay the models out for generation in a FrozenModel. Once frozen the
+	// model is frozen again after every training or update.
+	void freeze(const ContextIndex index = ContextIndex::OpenAddressing) {
+		m_contextIndex = index;
+		m_stayFrozen = true;
+		m_frozen = newFrozen(m_sampling == Sampling::Alias, index);
+		m_lengths.clear();
+	}
+
+	inline double prior() const {
+		return m_dPrior;
+	}
+
+	// The prior is applied when sampling, changing it needs no retraining
+	void setPrior(const double prior) {
+		m_dPrior = prior;
+		m_lengths.clear();
+	}
+
+	// Threads used to count the training data and to generate batches of
+	// words, 0 uses every core. The result doesn't depend on it.
+	void setThreads(const unsigned threads) {
+		m_threads = threads;
+	}
+
+	inline unsigned threads() const {
+		return m_threads ? m_threads : std::max(1u, std::thread::hardware_concurrency());
+	}
+
+	// Empty context to start a new word
+	inline Context context() const {
+		Context res(m_order, m_bits, m_padding);
+		if (m_frozen) {
+			res.setNode(m_frozen->start());
+		}
+		return res;
+	}
+
+	// Return the next char based on a context/word, letters that aren't in
+	// the alphabet are taken as '#'.
+	char generate(const std::string &word, Random &random) const {
+		Context context = this->context();
+		const size_t start = word.size() > static_cast<size_t>(m_order) ? word.size() - m_order : 0;
+		for (size_t i = start; i < word.size(); ++i) {
+			const int index = m_index[static_cast<unsigned char>(word[i])];
+			context.push(index < 0 ? m_padding : index);
+		}
+		if (m_frozen) {
+			uint32_t node = FrozenModel::NONE;
+			for (int i = m_order; i > 0 && node == FrozenModel::NONE; i--) {
+				node = m_frozen->find(i, context.last(i));
+			}
+			context.setNode(node);
+		}
+		return generate(context, random);
+	}
+
+	// Return the next char and append it to the context, doesn't allocate.
+	// Falls back to lower orders when the context wasn't seen in training.
+	// Frozen models follow their trie instead of looking every order up.
+	char generate(Context &context, Random &random) const {
+		char res = '#';
+		if (!isTrained()) {
+			return res;
+		}
+		if (m_frozen) {
+			const uint32_t node = context.node();
+			if (node == FrozenModel::NONE) {
+				return res;
+			}
+			const FrozenChain chain = m_frozen->chain(node);
+			size_t position;
+			const size_t index = selectIndex(chain, random, position);
+			context.push(index);
+			context.setNode(position != NO_POSITION ? chain.next[position]
+													: m_frozen->next(node, index));
+			return m_alphabet[index];
+		}
+
+		for (int i = m_order; i > 0; i--) {
+			const modelData &model = getModel(i);
+			auto it = model.find(context.last(i));
+
+			if (it != model.cend()) {
+				const size_t index = selectIndex((*it).second, random);
+				res = m_alphabet[index];
+				context.push(index);
+				break;
+			}
+		}
+		return res;
+	}
+
+	// Take minLength from 0 and maxLength up to MAX_WORD_LENGTH. False if
+	// the window holds no length.
+	static bool clampWindow(int &minLength, int &maxLength) {
+		minLength = std::max(minLength, 0);
+		maxLength = std::min(maxLength, MAX_WORD_LENGTH);
+		return minLength <= maxLength;
+	}
+
+	// Generate a word with a length in [minLength, maxLength], drawn from
+	// the words of the model in that window. False, with an empty word, if
+	// the model has none. See windowTable() for how.
+	bool generateWord(std::string &word, int minLength, int maxLength, Random &random) const {
+		word.clear();
+		if (!isTrained() || !clampWindow(minLength, maxLength)) {
+			return false;
+		}
+		return generateWord(word, minLength, maxLength,
+							windowTable(minLength, maxLength).get(), random);
+	}
+
+	// generateWord() of a clamped window with what windowTable() gave for
+	// it, for callers that keep it to generate many words
+	bool generateWord(std::string &word, const int minLength, const int maxLength,
+					  const LengthTable *table, Random &random) const
+	{
+		if (table) {
+			return generateWord(word, *table, random);
+		}
+		for (int i = 0; i < REJECTIONS; i++) {
+			if (drawWord(word, minLength, maxLength, random)) {
+				return true;
+			}
+		}
+		return finishWord(word, minLength, maxLength, random);
+	}
+
+	// A word of a clamped window REJECTIONS free draws missed: from its
+	// length table, or with more draws if it has none
+	bool finishWord(std::string &word, const int minLength, const int maxLength,
+					Random &random) const
+	{
+		if (const std::shared_ptr<const LengthTable> fallback = lengthTable(minLength, maxLength)) {
+			return generateWord(word, *fallback, random);
+		}
+		// the table would pass TABLE_BYTES
+		for (int i = REJECTIONS; i < MAX_REJECTIONS; i++) {
+			if (drawWord(word, minLength, maxLength, random)) {
+				return true;
+			}
+		}
+		word.clear();
+		return false;
+	}
+
+	// Draw from the words of the window of the table without rejecting any
+	bool generateWord(std::string &word, const LengthTable &table, Random &random) const {
+		word.clear();
+		if (table.empty()) {
+			return false;
+		}
+		uint32_t node = table.start();
+		for (int length = 0; ; length++) {
+			const size_t index = table.next(node, length, random);
+			if (index == m_padding) {
+				break;
+			}
+			word += m_alphabet[index];
+		}
+		return true;
+	}
+
+	// Append `count` words of the window of the table to `batch`. LANES
+	// words are generated in lock-step, a letter each in turn, so the
+	// lookups of one don't wait for those of the previous one; a word that
+	// ends hands its lane over to the next. The words are drawn like with
+	// generateWord(), the draws are only taken in another order.
+	void generateWords(WordBatch &batch, const size_t count, const LengthTable &table,
+					   Random &random) const
+	{
+		if (table.empty()) {
+			return;
+		}
+		std::array<uint32_t, LANES> nodes;
+		std::array<int, LANES> lengths;
+		lockStep(batch, count, [&](const size_t lane) {
+			nodes[lane] = table.start();
+			lengths[lane] = 0;
+		}, [&](const size_t lane, std::string &word) {
+			const size_t index = table.next(nodes[lane], lengths[lane], random);
+			if (index == m_padding) {
+				return LaneStep::Word;
+			}
+			word += m_alphabet[index];
+			++lengths[lane];
+			return LaneStep::Letter;
+		});
+	}
+
+	// generateWords() for a clamped window windowTable() has no table for:
+	// every lane draws with the sampler of the chains and rejects the words
+	// out of the window, and a word that takes more than REJECTIONS draws
+	// is finished alone like generateWord() does. The batch stops short
+	// where a word can't be made.
+	// On a frozen model a letter takes a lane three turns, AMAC style: the
+	// first two prefetch its node and then its chain, and the other lanes
+	// run while they load.
+	void generateWords(WordBatch &batch, const size_t count, const int minLength,
+					   const int maxLength, Random &random) const
+	{
+		std::vector<Context> contexts(LANES, context());
+		std::array<int, LANES> draws;
+		std::array<uint8_t, LANES> stages;
+		const FrozenModel *frozen = m_frozen.get();
+		lockStep(batch, count, [&](const size_t lane) {
+			contexts[lane] = context();
+			draws[lane] = 0;
+			stages[lane] = 0;
+		}, [&](const size_t lane, std::string &word) {
+			const uint32_t node = contexts[lane].node();
+			if (frozen && node != FrozenModel::NONE && stages[lane] < 2) {
+				if (stages[lane]++ == 0) {
+					frozen->prefetchNode(node);
+				} else {
+					frozen->prefetchChain(node);
+				}
+				return LaneStep::Letter;
+			}
+			stages[lane] = 0;
+			const char letter = generate(contexts[lane], random);
+			if (letter != '#') {
+				if (static_cast<int>(word.size()) < maxLength) {
+					word += letter;
+					return LaneStep::Letter;
+				}
+			} else if (static_cast<int>(word.size()) >= minLength) {
+				return LaneStep::Word;
+			}
+			word.clear();
+			contexts[lane] = context();
+			if (++draws[lane] < REJECTIONS) {
+				return LaneStep::Letter;
+			}
+			return finishWord(word, minLength, maxLength, random) ? LaneStep::Word
+																  : LaneStep::Failed;
+		});
+	}
+
+	// Add words of the window of the table to `batch`, whose words must be
+	// in it and different, until it has n or the window has no other. The
+	// words are drawn without replacement after those of the batch, see
+	// DistinctDraws.
+	void addDistinctWords(WordBatch &batch, const size_t n, const LengthTable &table,
+						  Random &random) const
+	{
+		DistinctDraws draws(table);
+		std::vector<uint8_t> letters;
+		for (size_t i = 0; i < batch.size(); ++i) {
+			letters.clear();
+			for (const char c : batch[i]) {
+				letters.push_back(m_index[static_cast<unsigned char>(c)]);
+			}
+			draws.take(letters);
+		}
+		std::string word;
+		while (batch.size() < n && draws.draw(letters, random)) {
+			word.clear();
+			for (const uint8_t letter : letters) {
+				word += m_alphabet[letter];
+			}
+			batch.push_back(word);
+		}
+	}
+
+	// How the words of a clamped window are drawn. When at least MIN_SHARE
+	// of the words drawn freely fall in it, they are drawn with the
+	// sampler of the chains and the others rejected, which is exact: none
+	// is returned. The share is estimated once per window with a stream
+	// of its own, so the choice doesn't depend on the caller's.
+	// Otherwise the words are drawn with the length table of the window,
+	// built on a frozen copy if the model isn't frozen, unless it would
+	// pass TABLE_BYTES: generateWord() then gives up after MAX_REJECTIONS.
+	std::shared_ptr<const LengthTable> windowTable(const int minLength, const int maxLength) const {
+		if (windowShare(minLength, maxLength) >= MIN_SHARE) {
+			return nullptr;
+		}
+		return lengthTable(minLength, maxLength);
+	}
+
+	// Length table of a window, 0 <= minLength <= maxLength, built on
+	// first use, null if it would take more than TABLE_BYTES. The oldest
+	// tables are dropped to keep them all within TABLE_BYTES.
+	std::shared_ptr<const LengthTable> lengthTable(const int minLength, int maxLength) const {
+		maxLength = std::min(maxLength, MAX_WORD_LENGTH);
+		const std::pair<int, int> window(minLength, maxLength);
+		{
+			std::shared_lock<std::shared_mutex> lock(m_lengths.mutex);
+			auto it = m_lengths.tables.find(window);
+			if (it != m_lengths.tables.cend()) {
+				return it->second;
+			}
+		}
+		const size_t bytes = LengthTable::bytes(maxLength, contexts());
+		if (bytes > TABLE_BYTES) {
+			return nullptr;
+		}
+		std::unique_lock<std::shared_mutex> lock(m_lengths.mutex);
+		auto it = m_lengths.tables.find(window);
+		if (it != m_lengths.tables.cend()) {
+			return it->second;
+		}
+		while (m_lengths.bytes + bytes > TABLE_BYTES) {
+			const auto oldest = m_lengths.tables.find(m_lengths.order.front());
+			m_lengths.bytes -= oldest->second->bytes();
+			m_lengths.tables.erase(oldest);
+			m_lengths.order.pop_front();
+		}
+		const std::shared_ptr<const LengthTable> res = std::make_shared<const LengthTable>(
+				lengthFrozen(), minLength, maxLength, m_dPrior, m_alphabet.size(), m_padding);
+		m_lengths.tables.emplace(window, res);
+		m_lengths.order.push_back(window);
+		m_lengths.bytes += bytes;
+		return res;
+	}
+
+	// Number of distinct words the model can generate with a length in
+	// [minLength, maxLength], UINT64_MAX if there are more. Without a
+	// prior it is the paths of the frozen trie counted from the longest
+	// length down. With one every letter, the end too, can follow every
+	// context, so it counts every string of the other letters that fits.
+	uint64_t capacity(int minLength, int maxLength) const {
+		if (!isTrained() || !clampWindow(minLength, maxLength)) {
+			return 0;
+		}
+		std::unique_lock<std::shared_mutex> lock(m_lengths.mutex);
+		auto it = m_lengths.capacities.find({minLength, maxLength});
+		if (it != m_lengths.capacities.cend()) {
+			return it->second;
+		}
+
+		uint64_t res = 0;
+		if (m_dPrior > 0.0) {
+			uint64_t words = 1;
+			for (int length = 0; length <= maxLength; length++) {
+				if (length >= minLength) {
+					res = saturatingAdd(res, words);
+				}
+				words = saturatingMultiply(words, m_alphabet.size() - 1);
+			}
+		} else {
+			res = countPaths(*lengthFrozen(), minLength, maxLength);
+		}
+		m_lengths.capacities.emplace(std::make_pair(minLength, maxLength), res);
+		return res;
+	}
+
+	// Call onWord(word, log of its probability) for every word the model
+	// can generate with a length in [minLength, maxLength]. Only branches
+	// that lead to some word of the window are followed, found with its
+	// length table: false, with no call, if the table can't be built.
+	template <typename OnWord>
+	bool forEachWord(int minLength, int maxLength, OnWord onWord) const {
+		if (!isTrained() || !clampWindow(minLength, maxLength)) {
+			return true;
+		}
+		const std::shared_ptr<const LengthTable> table = lengthTable(minLength, maxLength);
+		if (!table) {
+			return false;
+		}
+		if (!table->empty()) {
+			std::string word;
+			forEachWord(*table, minLength, maxLength, table->start(), word, 0.0, onWord);
+		}
+		return true;
+	}
+
+	void train(const std::vector<std::string> &trainData,
+			   const int order = 3, double dPrior = 0.0)
+	{
+		p_train(shardWords(trainData), order, dPrior);
+	}
+
+	// Train with the words of a mapped file, read in place
+	void train(const MappedCorpus &corpus, const int order = 3, double dPrior = 0.0) {
+		p_train(corpus.lines().split(shardCount(corpus.size(), MIN_SHARD_BYTES)), order, dPrior);
+	}
+
+	// Train with one word per line of the stream. The corpus is read in
+	// batches, so only a batch and the counts are ever in memory.
+	void train(std::istream &input, const int order = 3, double dPrior = 0.0) {
+		p_trainStream([&input](std::string &line) {
+			return static_cast<bool>(std::getline(input, line));
+		}, order, dPrior);
+	}
+
+	// Regular files are mapped in memory, anything else is streamed
+	void trainFile(const std::string &path, const int order = 3, double dPrior = 0.0) {
+		if (std::filesystem::is_regular_file(path)) {
+			train(MappedCorpus(path), order, dPrior);
+			return;
+		}
+		std::ifstream file(path);
+		if (!file) {
+			throw std::runtime_error("can't open " + path);
+		}
+		train(file, order, dPrior);
+	}
+
+	void trainFd(const int fd, const int order = 3, double dPrior = 0.0) {
+		FdLineReader reader(fd);
+		p_trainStream([&reader](std::string &line) {
+			return reader.next(line);
+		}, order, dPrior);
+	}
+
+	// Add words to a trained model without retraining it: their counts
+	// are folded into the chains and only the chains they touched get
+	// their sampling tables rebuilt. New letters widen every chain.
+	void addWords(const std::vector<std::string> &words) {
+		if (!isTrained()) {
+			train(words);
+			return;
+		}
+		p_update([&words](auto onBatch) {
+			onBatch(wordSpan(words));
+		});
+	}
+
+	// addWords() with one word per line of the stream, read in batches
+	void update(std::istream &input) {
+		if (!isTrained()) {
+			train(input);
+			return;
+		}
+		p_update([&input](auto onBatch) {
+			readBatches([&input](std::string &line) {
+				return static_cast<bool>(std::getline(input, line));
+			}, onBatch);
+		});
+	}
+
+	// Train with a range of words, read in batches like the streams
+	template <typename Iterator>
+	void train(Iterator begin, const Iterator end,
+			   const int order = 3, double dPrior = 0.0)
+	{
+		p_trainStream([&begin, &end](std::string &line) {
+			if (begin == end) {
+				return false;
+			}
+			line = *begin;
+			++begin;
+			return true;
+		}, order, dPrior);
+	}
+
+private:
+	double m_dPrior = 0.0;
+	int m_order = 0;
+	Sampling m_sampling = Sampling::Cumulative;
+	unsigned m_threads = 0;
+	ContextIndex m_contextIndex = ContextIndex::OpenAddressing;
+	// freeze() was called, the model is frozen again after every training
+	bool m_stayFrozen = false;
+
+	// List of letters in the model
+	std::vector<char> m_alphabet;
+	// Position of every char in the alphabet, -1 if it isn't there
+	std::array<int16_t, 256> m_index = emptyIndex();
+	// Bits taken by one letter in the context keys
+	int m_bits = 1;
+	uint64_t m_padding = 0;
+	// Katz's back-off model with high order models.
+	std::pmr::vector<modelData> m_models;
+	// generation copy of m_models, in the resource of the model
+	std::shared_ptr<const FrozenModel> m_frozen;
+
+	// Shares, length tables and capacities of the windows asked so far,
+	// and the frozen copy the tables are built on when the model isn't
+	// frozen. Copies start empty.
+	struct LengthCache {
+		std::shared_mutex mutex;
+		std::shared_ptr<const FrozenModel> frozen;
+		std::map<std::pair<int, int>, double> shares;
+		std::map<std::pair<int, int>, std::shared_ptr<const LengthTable>> tables;
+		// windows of the tables, oldest first, and the bytes they take
+		std::deque<std::pair<int, int>> order;
+		size_t bytes = 0;
+		std::map<std::pair<int, int>, uint64_t> capacities;
+
+		LengthCache() = default;
+
+		LengthCache(const LengthCache &) {
+		}
+
+		LengthCache &operator=(const LengthCache &) {
+			clear();
+			return *this;
+		}
+
+		void clear() {
+			std::unique_lock<std::shared_mutex> lock(mutex);
+			frozen.reset();
+			shares.clear();
+			tables.clear();
+			order.clear();
+			bytes = 0;
+			capacities.clear();
+		}
+	};
+	mutable LengthCache m_lengths;
+
+	// Times every letter was seen after every context of a given order.
+	// They only live while training, in a pool of their own: the arena of
+	// the model isn't made to take and give back that much memory.
+	typedef std::pmr::unordered_map<uint64_t, std::pmr::vector<uint32_t>> countData;
+
+	typedef std::span<const std::string> wordSpan;
+
+	// words, or bytes of a mapped corpus, below which adding a counting
+	// thread isn't worth it
+	static constexpr size_t MIN_SHARD_WORDS = 4096;
+	static constexpr size_t MIN_SHARD_BYTES = 1 << 16;
+	static constexpr size_t NO_POSITION = SIZE_MAX;
+
+	// words read at once when training from a stream
+	static constexpr size_t BATCH_WORDS = 1 << 16;
+
+	// words generated together by generateWords()
+	static constexpr size_t LANES = 16;
+
+	// Windows take a length table below MIN_SHARE of the words drawn
+	// freely, estimated with SHARE_DRAWS of them, see windowTable()
+	static constexpr int SHARE_DRAWS = 256;
+	static constexpr double MIN_SHARE = 1.0 / 8;
+	// words drawn freely for a word before taking the table, and when
+	// there is no table
+	static constexpr int REJECTIONS = 64;
+	static constexpr int MAX_REJECTIONS = 1 << 16;
+	// bytes of the length tables kept
+	static constexpr size_t TABLE_BYTES = size_t(1) << 27;
+
+	// The context keys of the highest order must fit in 64 bits
+	static void checkOrder(const int order, const int bits) {
+		if (order < 1 || order * bits > 64) {
+			throw std::invalid_argument("model order must be between 1 and "
+										+ std::to_string(64 / bits)
+										+ " for this alphabet");
+		}
+	}
+	void checkOrder(const int bits) const {
+		checkOrder(m_order, bits);
+	}
+
+	static int bitsFor(const size_t letters) {
+		int bits = 1;
+		while ((size_t(1) << bits) < letters) {
+			++bits;
+		}
+		return bits;
+	}
+
+	// Drop the model before training another, its frozen copy and length
+	// tables too
+	void reset(const int order, double dPrior) {
+		m_order = order;
+		m_models.clear();
+		m_models.resize(m_order);
+		m_dPrior = dPrior;
+		m_frozen.reset();
+		m_lengths.clear();
+	}
+
+	// counts of every order, allocated from `pool`
+	std::vector<countData> newCounts(std::pmr::memory_resource *pool) const {
+		std::vector<countData> res;
+		res.reserve(m_order);
+		for (int i = 0; i < m_order; i++) {
+			res.emplace_back(pool);
+		}
+		return res;
+	}
+
+	// Train with the words split in shards counted in parallel. The order
+	// is checked against their alphabet before the model is touched.
+	template <typename Words>
+	void p_train(const std::vector<Words> &shards, const int order, double dPrior) {
+		std::vector<char> alphabet = alphabetOf(shards);
+		checkOrder(order, bitsFor(alphabet.size()));
+		reset(order, dPrior);
+		m_alphabet = std::move(alphabet);
+		buildIndex();
+		// counts of every order come out of a single pass
+		std::pmr::unsynchronized_pool_resource pool;
+		std::vector<countData> counts = newCounts(&pool);
+		countSuccessors(shards, counts);
+		buildModels(counts);
+	}
+
+	// The alphabet isn't known up front: it grows with every batch that
+	// brings new letters and the counts gathered so far are rekeyed. A
+	// letter found midway can still make the order too high, the model
+	// trained before is then put back.
+	template <typename NextLine>
+	void p_trainStream(NextLine nextLine, const int order, double dPrior) {
+		checkOrder(order, bitsFor(1));
+		const int oldOrder = m_order;
+		const double oldPrior = m_dPrior;
+		std::vector<char> oldAlphabet = m_alphabet;
+		std::pmr::vector<modelData> oldModels(std::move(m_models));
+		std::shared_ptr<const FrozenModel> oldFrozen = m_frozen;
+		try {
+			reset(order, dPrior);
+			m_alphabet.assign(1, '#');
+			buildIndex();
+
+			std::pmr::unsynchronized_pool_resource pool;
+			std::vector<countData> counts = newCounts(&pool);
+			readBatches(nextLine, [this, &counts](const wordSpan words) {
+				int oldBits;
+				const std::vector<uint8_t> position = growAlphabet(words, oldBits);
+				if (!position.empty()) {
+					rekeyCounts(counts, position, oldBits);
+				}
+				countSuccessors(shardWords(words), counts);
+			});
+			buildModels(counts);
+		} catch (...) {
+			m_order = oldOrder;
+			m_dPrior = oldPrior;
+			m_alphabet = std::move(oldAlphabet);
+			buildIndex();
+			m_models = std::move(oldModels);
+			m_frozen = std::move(oldFrozen);
+			throw;
+		}
+	}
+
+	// Read the non empty lines of a source in batches of BATCH_WORDS
+	template <typename NextLine, typename OnBatch>
+	static void readBatches(NextLine nextLine, OnBatch onBatch) {
+		std::vector<std::string> batch(BATCH_WORDS);
+		bool more = true;
+
+		while (more) {
+			size_t size = 0;
+			while (size < batch.size() && (more = nextLine(batch[size]))) {
+				std::string &line = batch[size];
+				if (!line.empty() && line.back() == '\r') {
+					line.pop_back();
+				}
+				if (!line.empty()) {
+					++size;
+				}
+			}
+			onBatch(wordSpan(batch.data(), size));
+		}
+	}
+
+	// Fold the counts of the batches read into the chains. They are all
+	// counted before any chain is touched, so a letter that makes the order
+	// too high leaves the model as it was.
+	template <typename Read>
+	void p_update(Read read) {
+		const std::vector<char> oldAlphabet = m_alphabet;
+		const int oldBits = m_bits;
+		std::pmr::unsynchronized_pool_resource pool;
+		std::vector<countData> counts = newCounts(&pool);
+		try {
+			read([this, &counts](const wordSpan words) {
+				int bits;
+				const std::vector<uint8_t> position = growAlphabet(words, bits);
+				if (!position.empty()) {
+					rekeyCounts(counts, position, bits);
+				}
+				countSuccessors(shardWords(words), counts);
+			});
+		} catch (...) {
+			m_alphabet = oldAlphabet;
+			buildIndex();
+			throw;
+		}
+
+		try {
+			if (m_alphabet.size() != oldAlphabet.size()) {
+				std::vector<uint8_t> position(oldAlphabet.size());
+				for (size_t i = 0; i < oldAlphabet.size(); ++i) {
+					position[i] = m_index[static_cast<unsigned char>(oldAlphabet[i])];
+				}
+				rekeyModels(position, oldBits);
+			}
+			for (int i = 1; i <= m_order; i++) {
+				modelData &model = getModel(i);
+				for (const auto &it : counts[i -1]) {
+					Chain &chain = model[it.first];
+					std::vector<uint32_t> value = chain.counts(m_alphabet.size());
+					for (size_t j = 0; j < it.second.size(); ++j) {
+						value[j] = addCounts(value[j], it.second[j]);
+					}
+					chain.assign(value);
+				}
+				counts[i -1].clear();
+			}
+		} catch (...) {
+			// the frozen copy no longer matches the chains folded so far
+			buildSamplingTables();
+			throw;
+		}
+		buildSamplingTables();
+	}
+
+	// The alias tables are only laid out in a frozen copy, the model is
+	// frozen while Sampling::Alias is selected
+	void buildSamplingTables() {
+		m_lengths.clear();
+		if (isTrained() && (m_stayFrozen || m_sampling == Sampling::Alias)) {
+			m_frozen = newFrozen(m_sampling == Sampling::Alias, m_contextIndex);
+		} else {
+			m_frozen.reset();
+		}
+	}
+
+	std::shared_ptr<const FrozenModel> newFrozen(const bool alias, const ContextIndex index) const {
+		return std::allocate_shared<const FrozenModel>(
+				std::pmr::polymorphic_allocator<FrozenModel>(resource()), m_models, alias, index,
+				m_bits, m_alphabet.size(), m_padding, resource());
+	}
+
+	// m_frozen, or the copy the length tables are built on if the model
+	// isn't frozen. m_lengths.mutex must be held exclusively.
+	std::shared_ptr<const FrozenModel> lengthFrozen() const {
+		if (m_frozen) {
+			return m_frozen;
+		}
+		if (!m_lengths.frozen) {
+			m_lengths.frozen = newFrozen(false, ContextIndex::OpenAddressing);
+		}
+		return m_lengths.frozen;
+	}
+
+	// What a lane of lockStep() did with its turn
+	enum class LaneStep {
+		Letter,
+		Word,
+		// no word could be made, the batch stops
+		Failed
+	};
+
+	// Make `count` words LANES at a time into `batch`. start(lane) sets a
+	// lane up for a new word and step(lane, word) takes its turn. Short
+	// words end first, so they are put back in the order they were
+	// started: a prefix of the batch is then as good a sample as the rest.
+	template <typename Start, typename Step>
+	void lockStep(WordBatch &batch, const size_t count, Start start, Step step) const {
+		std::array<std::string, LANES> words;
+		// lanes still running, first `active` of them, and the number of
+		// the word of every lane, counted in the order they were started
+		std::array<uint32_t, LANES> lanes;
+		std::array<uint32_t, LANES> slots;
+		// position of every word in `done`, UINT32_MAX until it's done
+		std::vector<uint32_t> order(count, UINT32_MAX);
+		WordBatch done;
+		done.reserve(count, 0);
+		size_t started = std::min(count, LANES);
+		size_t active = started;
+		std::iota(lanes.begin(), lanes.end(), 0);
+		std::iota(slots.begin(), slots.end(), 0);
+		for (size_t lane = 0; lane < started; ++lane) {
+			start(lane);
+		}
+
+		while (active) {
+			for (size_t i = 0; i < active; ) {
+				const uint32_t lane = lanes[i];
+				const LaneStep res = step(lane, words[lane]);
+				if (res == LaneStep::Letter) {
+					++i;
+					continue;
+				}
+				if (res == LaneStep::Failed) {
+					active = 0;
+					break;
+				}
+				order[slots[lane]] = done.size();
+				done.push_back(words[lane]);
+				words[lane].clear();
+				if (started < count) {
+					start(lane);
+					slots[lane] = started++;
+					++i;
+					continue;
+				}
+				// no word left to start
+				std::swap(lanes[i], lanes[--active]);
+			}
+		}
+
+		batch.reserve(batch.size() + done.size(), batch.chars().size() + done.chars().size());
+		for (const uint32_t i : order) {
+			if (i == UINT32_MAX) {
+				break;
+			}
+			batch.push_back(done[i]);
+		}
+	}
+
+	// Draw a word with the sampler of the chains, given up once it is
+	// longer than maxLength. True if its length is in the window.
+	bool drawWord(std::string &word, const int minLength, const int maxLength,
+				  Random &random) const
+	{
+		word.clear();
+		Context context = this->context();
+		for (char letter = generate(context, random); letter != '#';
+			 letter = generate(context, random))
+		{
+			if (static_cast<int>(word.size()) == maxLength) {
+				return false;
+			}
+			word += letter;
+		}
+		return static_cast<int>(word.size()) >= minLength;
+	}
+
+	// Share of the words drawn freely that fall in the window
+	double windowShare(const int minLength, const int maxLength) const {
+		const std::pair<int, int> window(minLength, maxLength);
+		{
+			std::shared_lock<std::shared_mutex> lock(m_lengths.mutex);
+			auto it = m_lengths.shares.find(window);
+			if (it != m_lengths.shares.cend()) {
+				return it->second;
+			}
+		}
+		Random random((uint64_t(uint32_t(minLength)) << 32) | uint32_t(maxLength));
+		std::string word;
+		int hits = 0;
+		for (int i = 0; i < SHARE_DRAWS; i++) {
+			hits += drawWord(word, minLength, maxLength, random);
+		}
+		const double share = static_cast<double>(hits) / SHARE_DRAWS;
+		std::unique_lock<std::shared_mutex> lock(m_lengths.mutex);
+		m_lengths.shares.emplace(window, share);
+		return share;
+	}
+
+	static inline uint64_t saturatingAdd(const uint64_t a, const uint64_t b) {
+		return a + b < a ? UINT64_MAX : a + b;
+	}
+
+	static inline uint64_t saturatingMultiply(const uint64_t a, const uint64_t b) {
+		return b && a > UINT64_MAX / b ? UINT64_MAX : a * b;
+	}
+
+	// Paths of the trie through the letters seen that end in the window,
+	// one row of lengths at a time; the last column is NONE
+	uint64_t countPaths(const FrozenModel &frozen, const int minLength, const int maxLength) const {
+		const size_t nodes = frozen.size();
+		std::vector<uint64_t> after(nodes + 1, 0);
+		std::vector<uint64_t> current(nodes + 1);
+
+		for (int length = maxLength; length >= 0; length--) {
+			const uint64_t end = length >= minLength ? 1 : 0;
+			for (uint32_t node = 0; node < nodes; ++node) {
+				const FrozenChain chain = frozen.chain(node);
+				uint64_t words = 0;
+				for (uint32_t i = 0; i < chain.n; ++i) {
+					if (chain.letters[i] == m_padding) {
+						words = saturatingAdd(words, end);
+					} else if (length < maxLength) {
+						words = saturatingAdd(words, after[std::min<size_t>(chain.next[i], nodes)]);
+					}
+				}
+				current[node] = words;
+			}
+			current[nodes] = end;
+			after.swap(current);
+		}
+		return after[std::min<size_t>(frozen.start(), nodes)];
+	}
+
+	template <typename OnWord>
+	void forEachWord(const LengthTable &table, const int minLength, const int maxLength,
+					 const uint32_t node, std::string &word, const double logProbability,
+					 OnWord &onWord) const
+	{
+		const int length = word.size();
+		const FrozenModel &frozen = table.frozen();
+		const FrozenChain chain = frozen.chain(node);
+		const double total = chain.sum() + m_dPrior * m_alphabet.size();
+
+		// letters seen, and the others too with a prior
+		for (size_t letter = 0, i = 0; letter < m_alphabet.size(); ++letter) {
+			double weight = m_dPrior;
+			uint32_t next = FrozenModel::NONE;
+			if (i < chain.n && chain.letters[i] == letter) {
+				weight += i ? chain.totals[i] - chain.totals[i - 1] : chain.totals[0];
+				next = chain.next[i];
+				++i;
+			} else if (m_dPrior <= 0.0) {
+				continue;
+			} else if (letter != m_padding) {
+				next = frozen.next(node, letter);
+			}
+			const double logWeight = logProbability + std::log(weight / total);
+
+			if (letter == m_padding) {
+				if (length >= minLength) {
+					onWord(std::string_view(word), logWeight);
+				}
+				continue;
+			}
+			if (length >= maxLength) {
+				continue;
+			}
+			word += m_alphabet[letter];
+			if (next == FrozenModel::NONE) {
+				// nothing was seen after it, the word ends there
+				if (length + 1 >= minLength) {
+					onWord(std::string_view(word), logWeight);
+				}
+			} else if (table.possible(next, length + 1)) {
+				forEachWord(table, minLength, maxLength, next, word, logWeight, onWord);
+			}
+			word.pop_back();
+		}
+	}
+
+	// build the chains of every order, releasing the counts on the way
+	void buildModels(std::vector<countData> &counts) {
+		for (int i = 1; i <= m_order; i++) {
+			buildChains(counts[i -1], i);
+			counts[i -1].clear();
+		}
+		buildSamplingTables();
+	}
+	
+	modelData& getModel(int order) {
+		return m_models[order -1];
+	}
+	const modelData& getModel(int order) const {
+		return m_models[order -1];
+	}
+
+	// Every letter weighs its count plus the prior. The random value either
+	// falls in the prior, spread evenly over the alphabet, or in the counts
+	// of the letters seen; `position` is where the letter is in the chain,
+	// or NO_POSITION if it came from the prior.
+	template <typename ChainType>
+	size_t selectIndex(const ChainType &chain, Random &random, size_t &position) const {
+		const size_t letters = m_alphabet.size();
+		const double priors = m_dPrior * letters;
+		double value = random.uniform() * (chain.sum() + priors);
+
+		if (value < priors) {
+			position = NO_POSITION;
+			return std::min(static_cast<size_t>(value / m_dPrior), letters - 1);
+		}
+		value -= priors;
+		if constexpr (std::is_same_v<ChainType, FrozenChain>) {
+			if (chain.alias) {
+				position = selectAlias(chain, value);
+				return chain.letter(position);
+			}
+		}
+		position = std::min(chain.search(value), chain.size() - 1);
+		return chain.letter(position);
+	}
+
+	template <typename ChainType>
+	inline size_t selectIndex(const ChainType &chain, Random &random) const {
+		size_t position;
+		return selectIndex(chain, random, position);
+	}
+
+	// one value picks a column and decides between it and its alias
+	size_t selectAlias(const FrozenChain &chain, double value) const {
+		const size_t n = chain.size();
+		value = value / chain.sum() * n;
+		const size_t column = std::min(static_cast<size_t>(value), n - 1);
+
+		if (value - column < chain.aliasProb[column]) {
+			return column;
+		}
+		return chain.alias[column];
+	}
+
+	// Number of shards to count `work` with, each of at least `minWork`
+	size_t shardCount(const size_t work, const size_t minWork) const {
+		const size_t shards = threads();
+		return std::max<size_t>(1, std::min(shards, work / minWork));
+	}
+
+	std::vector<wordSpan> shardWords(const wordSpan words) const {
+		const size_t shards = shardCount(words.size(), MIN_SHARD_WORDS);
+		const size_t shardSize = (words.size() + shards - 1) / shards;
+		std::vector<wordSpan> res;
+		for (size_t i = 0; i < shards; i++) {
+			const size_t begin = std::min(words.size(), i * shardSize);
+			res.push_back(words.subspan(begin, std::min(words.size() - begin, shardSize)));
+		}
+		return res;
+	}
+
+	// Count the chars after each group of n chars for every order up to
+	// m_order and add them to `counts`. Every shard but the first is
+	// counted by its own thread, then the counts are added up in shard
+	// order. Every thread counts in a pool of its own.
+	template <typename Words>
+	void countSuccessors(const std::vector<Words> &shards,
+						 std::vector<countData> &counts) const
+	{
+		std::vector<std::unique_ptr<std::pmr::unsynchronized_pool_resource>> pools;
+		std::vector<std::vector<countData>> shardCounts;
+		for (size_t i = 1; i < shards.size(); i++) {
+			pools.push_back(std::make_unique<std::pmr::unsynchronized_pool_resource>());
+			shardCounts.push_back(newCounts(pools.back().get()));
+		}
+		std::vector<std::thread> workers;
+
+		for (size_t i = 1; i < shards.size(); i++) {
+			workers.emplace_back([this, &shards, &shardCounts, i]() {
+				countWords(shards[i], shardCounts[i -1]);
+			});
+		}
+		countWords(shards[0], counts);
+		for (std::thread &worker : workers) {
+			worker.join();
+		}
+		for (std::vector<countData> &shard : shardCounts) {
+			for (int j = 0; j < m_order; j++) {
+				mergeCounts(counts[j], shard[j]);
+				shard[j].clear();
+			}
+		}
+	}
+
+	template <typename Words>
+	void countWords(const Words &words, std::vector<countData> &counts) const {
+		for (const std::string_view word : words) {
+			Context context = this->context();
+
+			for (const char c : word) {
+				const uint8_t index = m_index[static_cast<unsigned char>(c)];
+				countSuccessor(counts, context, index);
+				context.push(index);
+			}
+			countSuccessor(counts, context, m_padding);
+		}
+	}
+
+	static void mergeCounts(countData &counts, countData &other) {
+		for (auto &it : other) {
+			std::pmr::vector<uint32_t> &chain = counts[it.first];
+			if (chain.empty()) {
+				chain = std::move(it.second);
+				continue;
+			}
+			for (size_t i = 0; i < chain.size(); ++i) {
+				chain[i] = addCounts(chain[i], it.second[i]);
+			}
+		}
+	}
+
+	inline void countSuccessor(std::vector<countData> &counts,
+							   const Context &context, const uint8_t index) const
 	{
-		srand (time(NULL));
-		m_models.resize(m_order);
-		p_train(trainData);
+		for (int i = 1; i <= m_order; i++) {
+			std::pmr::vector<uint32_t> &chain = counts[i -1][context.last(i)];
+			if (chain.empty()) {
+				chain.resize(m_alphabet.size());
+			}
+			chain[index] += chain[index] != UINT32_MAX;
+		}
 	}
 
-	Model(ExportedModel &&model) :
-		m_order(model.models.size() -1),
-		m_alphabet(model.alphabet),
-		m_models(model.models)
-	{
-		srand (time(NULL));
+	// generate the chains for a given order based on its counts
+	void buildChains(const countData &counts, const int order) {
+		modelData &model = getModel(order);
+		model.reserve(counts.size());
+
+		for (const auto &it : counts) {
+			model[it.first].assign(it.second);
+		}
 	}
 
-	Model(const ExportedModel &model) :
-		m_order(model.models.size() -1),
-		m_alphabet(model.alphabet),
-		m_models(model.models)
+	// Add the letters of the words missing from the alphabet. Returns the
+	// new position of every old letter, or nothing if no letter was added.
+	std::vector<uint8_t> growAlphabet(const wordSpan words, int &oldBits) {
+		oldBits = m_bits;
+		std::array<bool, 256> present{};
+		for (const char c : m_alphabet) {
+			present[static_cast<unsigned char>(c)] = true;
+		}
+		markLetters(words, present);
+		const std::vector<char> alphabet = lettersOf(present);
+
+		std::vector<uint8_t> position;
+		if (alphabet.size() == m_alphabet.size()) {
+			return position;
+		}
+		checkOrder(bitsFor(alphabet.size()));
+
+		const std::vector<char> oldAlphabet = m_alphabet;
+		m_alphabet = alphabet;
+		buildIndex();
+
+		position.resize(oldAlphabet.size());
+		for (size_t i = 0; i < oldAlphabet.size(); ++i) {
+			position[i] = m_index[static_cast<unsigned char>(oldAlphabet[i])];
+		}
+		return position;
+	}
+
+	// Key of a context of the old alphabet with the new positions
+	uint64_t rekey(const uint64_t key, const int order,
+				   const std::vector<uint8_t> &position, const int oldBits) const
 	{
-		srand (time(NULL));
+		const uint64_t oldMask = (UINT64_C(1) << oldBits) - 1;
+		uint64_t res = 0;
+		for (int i = 0; i < order; i++) {
+			const uint64_t index = (key >> (i * oldBits)) & oldMask;
+			res |= static_cast<uint64_t>(position[index]) << (i * m_bits);
+		}
+		return res;
 	}
 
-	Model() : m_order(0)
+	void rekeyCounts(std::vector<countData> &counts,
+					 const std::vector<uint8_t> &position, const int oldBits) const
 	{
-		srand (time(NULL));
+		for (int order = 1; order <= m_order; order++) {
+			countData rekeyed(counts[order -1].get_allocator());
+			rekeyed.reserve(counts[order -1].size());
+
+			for (auto &it : counts[order -1]) {
+				std::pmr::vector<uint32_t> &chain = rekeyed[rekey(it.first, order, position, oldBits)];
+				chain.resize(m_alphabet.size());
+				for (size_t i = 0; i < it.second.size(); ++i) {
+					chain[position[i]] = it.second[i];
+				}
+			}
+			counts[order -1].swap(rekeyed);
+		}
 	}
-	
-	ExportedModel exportData() const {
-		ExportedModel res{m_alphabet, m_models};
+
+	// New letters get no count in every chain
+	void rekeyModels(const std::vector<uint8_t> &position, const int oldBits) {
+		for (int order = 1; order <= m_order; order++) {
+			modelData rekeyed(resource());
+			rekeyed.reserve(getModel(order).size());
+
+			for (auto &it : getModel(order)) {
+				// the positions keep the old letters in order
+				Chain &chain = rekeyed[rekey(it.first, order, position, oldBits)];
+				chain = std::move(it.second);
+				for (uint8_t &letter : chain.letters()) {
+					letter = position[letter];
+				}
+			}
+			getModel(order).swap(rekeyed);
+		}
+	}
+
+	// no char is in the alphabet
+	static constexpr std::array<int16_t, 256> emptyIndex() {
+		std::array<int16_t, 256> res;
+		res.fill(-1);
 		return res;
 	}
 
-	inline int order() const {
-		return m_order;
+	// Map every char to its position in the alphabet and size the keys
+	void buildIndex() {
+		m_index = emptyIndex();
+		for (size_t i = 0; i < m_alphabet.size(); ++i) {
+			m_index[static_cast<unsigned char>(m_alphabet[i])] = i;
+		}
+		m_padding = m_index['#'];
+		m_bits = bitsFor(m_alphabet.size());
+	}
+	
+	// List of all the chars in the training data, '#' included. The chars
+	// are found with a table of the bytes present, one store per char of
+	// the corpus.
+	template <typename Words>
+	static std::vector<char> alphabetOf(const std::vector<Words> &shards) {
+		std::array<bool, 256> present{};
+		present['#'] = true;
+		for (const Words &words : shards) {
+			markLetters(words, present);
+		}
+		return lettersOf(present);
 	}
 
-	inline bool isTrained() const {
-		return !m_models.empty();
+	template <typename Words>
+	static void markLetters(const Words &words, std::array<bool, 256> &present) {
+		for (const std::string_view word : words) {
+			for (const char c : word) {
+				present[static_cast<unsigned char>(c)] = true;
+			}
+		}
 	}
 
-	// Return the next char based on a context/word
-	char generate(const std::string &context) const {
-		char res = '#';
-		if (!isTrained()) {
-			return res;
+	// Present chars in sorted order
+	static std::vector<char> lettersOf(const std::array<bool, 256> &present) {
+		std::vector<char> letters;
+		for (int c = CHAR_MIN; c <= CHAR_MAX; ++c) {
+			if (present[static_cast<unsigned char>(c)]) {
+				letters.push_back(static_cast<char>(c));
+			}
 		}
-		int order = m_order;
+		return letters;
+	}
+};
 
-		for (int i = m_order; i > 0; i--) {
-			std::string s = context.substr(context.size() - i, i);
-			const modelData &model = getModel(order);
-			auto it = model.find(s);
+// Set of words stored elsewhere, by their index. An open addressing table
+// keeps the index and the hash of every word: growing it hashes no word
+// again, and words are only compared when their hashes are equal.
+class WordSet {
+public:
+	explicit WordSet(const size_t words = 0) : m_size(0) {
+		reserve(words);
+	}
 
-			if (it != model.cend()) {
-				res = m_alphabet[selectIndex((*it).second)];
-				break;
-			}
+	void reserve(const size_t words) {
+		size_t capacity = 16;
+		while (capacity < words * 2) {
+			capacity *= 2;
+		}
+		if (capacity > m_slots.size()) {
+			rehash(capacity);
 		}
-		return res;
 	}
 
-	void train(const std::vector<std::string> &trainData,
-			   const int order = 3, double dPrior = 0.0)
-	{
-		m_order = order;
-		m_models.resize(m_order);
-		for (auto &map: m_models) {
-			map.clear();
+	// Add words[index] unless an equal word is already in the set
+	template <typename Words>
+	bool insert(const Words &words, const size_t index) {
+		return insert(words, index, hash(words[index]));
+	}
+
+	// insert() with the hash of the word already known
+	template <typename Words>
+	bool insert(const Words &words, const size_t index, const uint64_t hash) {
+		const std::string_view word = words[index];
+		if ((m_size + 1) * 2 > m_slots.size()) {
+			rehash(m_slots.size() * 2);
 		}
-		m_dPrior = dPrior;
-		p_train(trainData);
+		size_t i = hash & (m_slots.size() - 1);
+		while (m_slots[i].index != NONE) {
+			if (m_slots[i].hash == hash && std::string_view(words[m_slots[i].index]) == word) {
+				return false;
+			}
+			i = (i + 1) & (m_slots.size() - 1);
+		}
+		m_slots[i] = Slot{hash, index};
+		++m_size;
+		return true;
+	}
+
+	static inline uint64_t hash(const std::string_view word) {
+		return std::hash<std::string_view>()(word);
 	}
 
 private:
-	double m_dPrior;
-	int m_order;
+	static constexpr size_t NONE = SIZE_MAX;
 
-	// List of letters in the model
-	std::vector<char> m_alphabet;
-	// Katz's back-off model with high order models.
-	std::vector<modelData> m_models;
+	struct Slot {
+		uint64_t hash = 0;
+		size_t index = NONE;
+	};
 
-	inline void p_train(const std::vector<std::string> &trainData) {
-		generateAlphabet(trainData);
-		// build the chains of every order
-		for (int i = 1; i <= m_order; i++) {
-			buildChains(trainData, i);
+	std::vector<Slot> m_slots;
+	size_t m_size;
+
+	void rehash(const size_t capacity) {
+		std::vector<Slot> slots(capacity);
+		for (const Slot &slot : m_slots) {
+			if (slot.index == NONE) {
+				continue;
+			}
+			size_t i = slot.hash & (capacity - 1);
+			while (slots[i].index != NONE) {
+				i = (i + 1) & (capacity - 1);
+			}
+			slots[i] = slot;
 		}
+		m_slots.swap(slots);
 	}
-	
-	modelData& getModel(int order) {
-		return m_models[order -1];
-	}
-	const modelData& getModel(int order) const {
-		return m_models[order -1];
-	}
+};
+
+// Endless range of new words, generated one at a time as they're read,
+// for pipelines such as
+//     generator.stream(3, 8) | std::views::filter(f) | std::views::take(n)
+// It keeps its random stream and its last word between reads, and only
+// ends if the model has no word in the window. The model must outlive it
+// and not be trained meanwhile.
+class WordStream : public std::ranges::view_interface<WordStream> {
+public:
+	class iterator {
+	public:
+		typedef std::string value_type;
+		typedef std::ptrdiff_t difference_type;
 
-	size_t selectIndex(const std::vector<double> &chain) const {
-		double accumulator = 0.0;
-		std::vector<double> totals;
-		
-		for (const double weight : chain) {
-			accumulator += weight;
-			totals.push_back(accumulator);
+		iterator() : m_stream(nullptr) {
 		}
 
-		double randRes = static_cast <double> (rand()) / static_cast <double> (RAND_MAX);
-		double random = randRes * accumulator;
+		explicit iterator(WordStream *stream) : m_stream(stream) {
+		}
 
-		for (size_t i = 0; i < totals.size(); ++i) {
-			if (random < totals[i]) {
-				return i;
-			}
+		inline const std::string &operator*() const {
+			return m_stream->m_word;
 		}
-		return 0;
+
+		inline iterator &operator++() {
+			m_stream->next();
+			return *this;
+		}
+
+		inline void operator++(int) {
+			m_stream->next();
+		}
+
+		inline bool operator==(std::default_sentinel_t) const {
+			return m_stream->m_done;
+		}
+
+	private:
+		WordStream *m_stream;
+	};
+
+	WordStream() : m_model(nullptr), m_done(true) {
 	}
 
-	// generate the chain for a given order based on the training data,
-	// the chain vector must be initialized before calling this function.
-	void buildChains(const std::vector<std::string> &trainData,
-					 const int order)
+	WordStream(const Model &model, int minLength, int maxLength, const Random &random) :
+		m_model(&model), m_random(random), m_done(true)
 	{
-		// Generate observations (chars after ecah groups of n=order chars)
-		const std::string padding(order, '#');
-		std::unordered_map<std::string, std::vector<char>> observations;
+		if (model.isTrained() && Model::clampWindow(minLength, maxLength)) {
+			m_minLength = minLength;
+			m_maxLength = maxLength;
+			m_table = model.windowTable(minLength, maxLength);
+			m_done = false;
+		}
+	}
+
+	// The first word is generated here, the range can only be read once
+	iterator begin() {
+		next();
+		return iterator(this);
+	}
 
-		for (std::string word : trainData) {
-			word = padding + word + "#";
+	inline std::default_sentinel_t end() const {
+		return std::default_sentinel;
+	}
 
-			for (int i = 0; i < word.length() - order; i++) {
-				std::string key = word.substr(i, order);
+private:
+	const Model *m_model;
+	int m_minLength;
+	int m_maxLength;
+	// none if the words are drawn freely
+	std::shared_ptr<const LengthTable> m_table;
+	Random m_random;
+	std::string m_word;
+	bool m_done;
 
-				std::vector<char> &value = observations[key];
-				value.push_back(word.at(i + order));
-			}
+	void next() {
+		if (!m_done) {
+			m_done = !m_model->generateWord(m_word, m_minLength, m_maxLength, m_table.get(),
+											m_random);
+		}
+	}
+};
+
+// Whether newWords() made all the words asked for
+enum class BatchStatus {
+	Complete,
+	Partial
+};
+
+// Worker threads kept between parallel calls. The calling thread takes
+// jobs too; a call made while another one has the workers runs its jobs
+// alone. Copies start with no workers.
+class ThreadPool {
+public:
+	ThreadPool() = default;
+
+	ThreadPool(const ThreadPool &) {
+	}
+
+	ThreadPool &operator=(const ThreadPool &) {
+		return *this;
+	}
+
+	~ThreadPool() {
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stop = true;
+		}
+		m_wake.notify_all();
+		for (std::thread &worker : m_workers) {
+			worker.join();
 		}
-		// build the chain
-		for (auto it : observations) {
-			const std::string &key = it.first;
-			const std::vector<char> &value = it.second;
+	}
 
-			for (const char prediction : m_alphabet) {
-				std::vector<double> &chain = getModel(order)[key];
-				int count = 0;
-				for (const char c : value) {
-					if (prediction == c) {
-						++count;
-					}
+	// Run job(0) to job(jobs - 1) on up to `threads` threads, the calling
+	// one included. The first exception a job throws stops the jobs not
+	// started and is thrown again once every thread is done.
+	template <typename Job>
+	void run(const unsigned threads, const size_t jobs, Job job) {
+		std::atomic<size_t> next(0);
+		std::mutex failed;
+		std::exception_ptr error;
+		auto work = [&next, &job, jobs, &failed, &error]() {
+			try {
+				for (size_t i = next++; i < jobs; i = next++) {
+					job(i);
 				}
-				chain.push_back(m_dPrior + count);
+			} catch (...) {
+				std::lock_guard<std::mutex> lock(failed);
+				if (!error) {
+					error = std::current_exception();
+				}
+				next = jobs;
+			}
+		};
+		const size_t helpers = std::min<size_t>(threads, jobs) - 1;
+		std::unique_lock<std::mutex> busy(m_busy, std::defer_lock);
+		if (helpers == 0 || !busy.try_lock()) {
+			work();
+			if (error) {
+				std::rethrow_exception(error);
 			}
+			return;
+		}
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			while (m_workers.size() < helpers) {
+				m_workers.emplace_back([this]() {
+					loop();
+				});
+			}
+			m_work = work;
+			m_wanted = m_running = helpers;
+			++m_round;
+		}
+		m_wake.notify_all();
+		work();
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_done.wait(lock, [this]() {
+			return m_running == 0;
+		});
+		m_work = nullptr;
+		if (error) {
+			std::rethrow_exception(error);
 		}
 	}
-	
-	// Generate a list of all the chars in the training data
-	void generateAlphabet(const std::vector<std::string> &trainData) {
-		m_alphabet.resize(0);
-		m_alphabet.push_back('#');
-		for (const std::string &word : trainData) {
 
-			for (const char c : word) {
-				if (std::find(m_alphabet.begin(), m_alphabet.end(), c) == m_alphabet.end()) {
-					m_alphabet.push_back(c);
-				}
+private:
+	// held by the call that has the workers
+	std::mutex m_busy;
+	std::mutex m_mutex;
+	std::condition_variable m_wake;
+	std::condition_variable m_done;
+	std::vector<std::thread> m_workers;
+	// work of the current call, the workers it still wants and those
+	// that haven't finished
+	std::function<void()> m_work;
+	size_t m_wanted = 0;
+	size_t m_running = 0;
+	uint64_t m_round = 0;
+	bool m_stop = false;
+
+	void loop() {
+		uint64_t round = 0;
+		std::unique_lock<std::mutex> lock(m_mutex);
+		while (true) {
+			m_wake.wait(lock, [this, round]() {
+				return m_stop || m_round != round;
+			});
+			if (m_stop) {
+				return;
+			}
+			round = m_round;
+			if (m_wanted == 0) {
+				continue;
+			}
+			--m_wanted;
+			lock.unlock();
+			m_work();
+			lock.lock();
+			if (--m_running == 0) {
+				m_done.notify_one();
 			}
 		}
-		std::sort(m_alphabet.begin(), m_alphabet.end());
 	}
 };
 
 class WordGenerator {
 public:
 
-	WordGenerator() {
+	// The model is allocated from `resource`, see Model
+	explicit WordGenerator(std::pmr::memory_resource *resource = std::pmr::get_default_resource()) :
+		m_model(resource)
+	{
 	}
 
-	WordGenerator(ExportedModel &&model) :
-		m_model(model)
+	WordGenerator(const ExportedModel &model,
+		std::pmr::memory_resource *resource = std::pmr::get_default_resource()) :
+		m_model(model, resource)
 	{
 	}
 	
 	WordGenerator(const std::vector<std::string> &trainData,
-		const int order, const double prior) :
-		m_model(trainData, order, prior)
+		const int order, const double prior,
+		std::pmr::memory_resource *resource = std::pmr::get_default_resource()) :
+		m_model(trainData, order, prior, resource)
 	{
 	}
 
@@ -223,54 +3169,273 @@ public:
 		m_model.train(trainData, order, dPrior);
 	}
 
+	void train(std::istream &input, const int order = 3, double dPrior = 0.0) {
+		m_model.train(input, order, dPrior);
+	}
+
+	void trainFile(const std::string &path, const int order = 3, double dPrior = 0.0) {
+		m_model.trainFile(path, order, dPrior);
+	}
+
+	void trainFd(const int fd, const int order = 3, double dPrior = 0.0) {
+		m_model.trainFd(fd, order, dPrior);
+	}
+
+	void train(const MappedCorpus &corpus, const int order = 3, double dPrior = 0.0) {
+		m_model.train(corpus, order, dPrior);
+	}
+
+	template <typename Iterator>
+	void train(Iterator begin, const Iterator end,
+			   const int order = 3, double dPrior = 0.0)
+	{
+		m_model.train(begin, end, order, dPrior);
+	}
+
+	void addWords(const std::vector<std::string> &words) {
+		m_model.addWords(words);
+	}
+
+	void update(std::istream &input) {
+		m_model.update(input);
+	}
+
 	inline bool isTrained() const {
 		return m_model.isTrained();
 	}
 
-	std::string newWord(const int minLength, const int maxLength) const {
-		std::string word;
+	void setSampling(const Sampling sampling) {
+		m_model.setSampling(sampling);
+	}
 
-		if (!isTrained()) {
-			return word;
-		}
+	void setThreads(const unsigned threads) {
+		m_model.setThreads(threads);
+	}
 
-		int i = 0;
-		do {
-			word = std::string(m_model.order(), '#');
-			char letter = m_model.generate(word);
-			
-			while (letter != '#') {
-				word += letter;
-				letter = m_model.generate(word);
-			}
-			
-			word.erase(std::remove(word.begin(), word.end(), '#'), word.end());
-		} while (++i < 100 && (word.size() < minLength || word.size() > maxLength));
+	void setPrior(const double prior) {
+		m_model.setPrior(prior);
+	}
+
+	void freeze(const ContextIndex index = ContextIndex::OpenAddressing) {
+		m_model.freeze(index);
+	}
+
+	void seed(const uint64_t value) {
+		m_random.seed(value);
+	}
+
+	// Independent random stream for the const overloads, which can be called
+	// from many threads at once as long as each one has its own stream.
+	Random split() {
+		return m_random.split();
+	}
 
+	std::string newWord(const int minLength, const int maxLength) {
+		return newWord(minLength, maxLength, m_random);
+	}
+
+	std::string newWord(const int minLength, const int maxLength,
+						Random &random) const
+	{
+		std::string word;
+		newWord(word, minLength, maxLength, random);
 		return word;
 	}
+
+	// Generate a word into `word`, reusing its storage. Once it has grown
+	// to the longest word no more allocations are made. The length is
+	// always in the window, the word is empty if the model has no word
+	// that long.
+	void newWord(std::string &word, const int minLength, const int maxLength,
+				 Random &random) const
+	{
+		m_model.generateWord(word, minLength, maxLength, random);
+	}
 	
+	// Endless range of new words, with a random stream split from the
+	// generator's
+	WordStream stream(const int minLength, const int maxLength) {
+		return WordStream(m_model, minLength, maxLength, m_random.split());
+	}
+
+	WordStream stream(const int minLength, const int maxLength, const Random &random) const {
+		return WordStream(m_model, minLength, maxLength, random);
+	}
+
+	std::vector<std::string> newWords(
+		const size_t n,
+		const int minLength,
+		const int maxLength,
+		bool repeat = false)
+	{
+		return newWords(n, minLength, maxLength, m_random, repeat);
+	}
+
 	std::vector<std::string> newWords(
 		const size_t n,
 		const int minLength,
 		const int maxLength,
-		bool repeat = false) const 
+		Random &random,
+		bool repeat = false) const
 	{
+		WordBatch batch;
+		newWords(batch, n, minLength, maxLength, random, repeat);
+
 		std::vector<std::string> words;
+		words.reserve(batch.size());
+		for (size_t i = 0; i < batch.size(); ++i) {
+			words.emplace_back(batch[i]);
+		}
+		return words;
+	}
 
-		if (!isTrained()) {
-			return words;
+	BatchStatus newWords(
+		WordBatch &batch,
+		const size_t n,
+		const int minLength,
+		const int maxLength,
+		bool repeat = false)
+	{
+		return newWords(batch, n, minLength, maxLength, m_random, repeat);
+	}
+
+	// Generate n words into `batch`, replacing its words. Every chunk of
+	// CHUNK_WORDS takes its own stream split from `random` in order, so
+	// the words don't depend on the threads. Without repeats the first of
+	// equal words is kept, and once the rounds of chunks would draw past
+	// MAX_DRAWS times n words the rest come from DistinctDraws. A model
+	// that can't make twice n words in the window has them all listed and
+	// sampled instead. Partial is returned with fewer than n words: the
+	// window has no more, or its length table would pass Model::TABLE_BYTES.
+	BatchStatus newWords(
+		WordBatch &batch,
+		const size_t n,
+		const int minLength,
+		const int maxLength,
+		Random &random,
+		bool repeat = false) const
+	{
+		batch.clear();
+
+		if (!isTrained() || n == 0) {
+			return n == 0 ? BatchStatus::Complete : BatchStatus::Partial;
 		}
+		if (!repeat && m_model.capacity(minLength, maxLength) / 2 <= n
+			&& sampleWords(batch, n, minLength, maxLength, random))
+		{
+			return batch.size() == n ? BatchStatus::Complete : BatchStatus::Partial;
+		}
+
+		const unsigned threads = n < CHUNK_WORDS ? 1 : m_model.threads();
+		const size_t shards = repeat ? 0 : threads;
+		std::vector<Chunk> chunks;
+		std::vector<WordSet> seen(shards);
+		const ChunkWords candidates{chunks};
+		size_t found = 0;
+		size_t generated = 0;
+		// share of new words in the last round, to size the next one
+		double yield = 1.0;
+		bool distinct = false;
+
+		while (found < n) {
+			const double next = std::ceil((n - found) / yield);
+			if (generated + next > static_cast<double>(MAX_DRAWS) * n) {
+				distinct = true;
+				break;
+			}
+			const size_t first = chunks.size();
+			const size_t wanted = static_cast<size_t>(next);
+			const size_t count = (wanted + CHUNK_WORDS - 1) / CHUNK_WORDS;
+			std::vector<Random> streams;
+			for (size_t i = 0; i < count; i++) {
+				streams.push_back(random.split());
+			}
+			chunks.resize(first + count);
+			m_pool.run(threads, count, [&](const size_t i) {
+				fillChunk(chunks[first + i], streams[i], std::min(CHUNK_WORDS, wanted - i * CHUNK_WORDS),
+						  minLength, maxLength, shards);
+			});
 
-		words.reserve(n);
+			size_t made = 0;
+			for (size_t i = first; i < chunks.size(); i++) {
+				made += chunks[i].words.size();
+			}
+			generated += made;
+			size_t added = made;
+			if (!repeat) {
+				added = 0;
+				m_pool.run(threads, shards, [&](const size_t shard) {
+					for (size_t i = first; i < chunks.size(); i++) {
+						Chunk &chunk = chunks[i];
+						for (uint32_t j = chunk.shardStart[shard]; j < chunk.shardStart[shard + 1]; ++j) {
+							const uint32_t word = chunk.byShard[j];
+							chunk.keep[word] = seen[shard].insert(candidates, i * CHUNK_WORDS + word,
+																  chunk.hashes[word]);
+						}
+					}
+				});
+				for (size_t i = first; i < chunks.size(); i++) {
+					added += std::accumulate(chunks[i].keep.cbegin(), chunks[i].keep.cend(), size_t(0));
+				}
+			}
+			found += added;
+			if (made < wanted) {
+				break;
+			}
+			yield = static_cast<double>(added) / made;
+		}
 
-		while (words.size() < n) {
-			std::string word = newWord(minLength, maxLength);
-			if (repeat || std::find(words.begin(), words.end(), word) == words.end()) {
-				words.push_back(word);
+		size_t chars = 0;
+		for (const Chunk &chunk : chunks) {
+			chars += chunk.words.chars().size();
+		}
+		batch.reserve(std::min(n, found), chars);
+		for (const Chunk &chunk : chunks) {
+			for (size_t i = 0; i < chunk.words.size() && batch.size() < n; ++i) {
+				if (repeat || chunk.keep[i]) {
+					batch.push_back(chunk.words[i]);
+				}
 			}
 		}
-		return words;
+		if (distinct) {
+			int shortest = minLength;
+			int longest = maxLength;
+			Model::clampWindow(shortest, longest);
+			if (const std::shared_ptr<const LengthTable> table = m_model.lengthTable(shortest, longest)) {
+				m_model.addDistinctWords(batch, n, *table, random);
+			}
+		}
+		return batch.size() == n ? BatchStatus::Complete : BatchStatus::Partial;
+	}
+
+	template <std::output_iterator<std::string_view> Output>
+	Output newWords(
+		Output out,
+		const size_t n,
+		const int minLength,
+		const int maxLength,
+		bool repeat = false)
+	{
+		return newWords(out, n, minLength, maxLength, m_random, repeat);
+	}
+
+	// Generate n words into an output iterator of string_view, such as
+	// std::ostream_iterator<std::string_view>(std::cout, "\n")
+	template <std::output_iterator<std::string_view> Output>
+	Output newWords(
+		Output out,
+		const size_t n,
+		const int minLength,
+		const int maxLength,
+		Random &random,
+		bool repeat = false) const
+	{
+		WordBatch batch;
+		newWords(batch, n, minLength, maxLength, random, repeat);
+		for (size_t i = 0; i < batch.size(); ++i) {
+			*out++ = batch[i];
+		}
+		return out;
 	}
 
 	ExportedModel exportData() const {
@@ -278,11 +3443,115 @@ public:
 	}
 
 private:
+	// words generated with one random stream by newWords()
+	static constexpr size_t CHUNK_WORDS = 1 << 12;
+	// words newWords() generates per word asked for, at most, before it
+	// draws the rest without replacement
+	static constexpr size_t MAX_DRAWS = 4;
+
+	// Draw min(n, words) different words of the window from all of them,
+	// without replacement by their probabilities: every word gets the key
+	// log(-log(u)) - log(p), the order of -log(u) / p, and the smallest
+	// keys are taken in order (Efraimidis and Spirakis). False if the
+	// words can't be listed, see Model::forEachWord().
+	bool sampleWords(WordBatch &batch, const size_t n, const int minLength,
+					 const int maxLength, Random &random) const
+	{
+		WordBatch words;
+		std::vector<std::pair<double, uint32_t>> keys;
+		const bool listed = m_model.forEachWord(minLength, maxLength,
+				[&](std::string_view word, double logProbability) {
+			const double u = random.uniform();
+			keys.emplace_back(std::log(-std::log1p(-u)) - logProbability, words.size());
+			words.push_back(word);
+		});
+		if (!listed) {
+			return false;
+		}
+
+		const size_t count = std::min(n, keys.size());
+		std::partial_sort(keys.begin(), keys.begin() + count, keys.end());
+		size_t chars = 0;
+		for (size_t i = 0; i < count; ++i) {
+			chars += words[keys[i].second].size();
+		}
+		batch.reserve(count, chars);
+		for (size_t i = 0; i < count; ++i) {
+			batch.push_back(words[keys[i].second]);
+		}
+		return true;
+	}
+
+	struct Chunk {
+		WordBatch words;
+		// the rest is only filled without repeats
+		std::vector<uint64_t> hashes;
+		// words of the chunk by shard, and where the words of every shard start
+		std::vector<uint32_t> byShard;
+		std::vector<uint32_t> shardStart;
+		// first time the word is seen
+		std::vector<uint8_t> keep;
+	};
+
+	// Words of all the chunks, word i of chunk c is word c * CHUNK_WORDS + i.
+	// The last chunk of a round may be shorter.
+	struct ChunkWords {
+		const std::vector<Chunk> &chunks;
+
+		inline std::string_view operator[](const size_t i) const {
+			return chunks[i / CHUNK_WORDS].words[i % CHUNK_WORDS];
+		}
+	};
+
 	Model m_model;
+	Random m_random;
+	mutable ThreadPool m_pool;
+
+	// Generate `count` words, none if the window has none, and sort them by
+	// shard
+	void fillChunk(Chunk &chunk, Random &random, const size_t count, const int minLength,
+				   const int maxLength, const size_t shards) const
+	{
+		chunk.words.reserve(count);
+		int shortest = minLength;
+		int longest = maxLength;
+		if (Model::clampWindow(shortest, longest)) {
+			// the table is taken once, not once per word
+			const std::shared_ptr<const LengthTable> table = m_model.windowTable(shortest, longest);
+			if (table) {
+				m_model.generateWords(chunk.words, count, *table, random);
+			} else {
+				m_model.generateWords(chunk.words, count, shortest, longest, random);
+			}
+		}
+		if (!shards) {
+			return;
+		}
+
+		const size_t size = chunk.words.size();
+		chunk.hashes.resize(size);
+		chunk.keep.assign(size, 0);
+		chunk.shardStart.assign(shards + 1, 0);
+		std::vector<uint32_t> shardOf(size);
+		for (size_t i = 0; i < size; ++i) {
+			chunk.hashes[i] = WordSet::hash(chunk.words[i]);
+			shardOf[i] = ((chunk.hashes[i] >> 32) * shards) >> 32;
+			++chunk.shardStart[shardOf[i] + 1];
+		}
+		std::partial_sum(chunk.shardStart.cbegin(), chunk.shardStart.cend(),
+						 chunk.shardStart.begin());
+		std::vector<uint32_t> position(chunk.shardStart.cbegin(), chunk.shardStart.cend() - 1);
+		chunk.byShard.resize(size);
+		for (size_t i = 0; i < size; ++i) {
+			chunk.byShard[position[shardOf[i]]++] = i;
+		}
+	}
 };
  
 
 
+// MARKOV_NO_MAIN leaves the program out, for the checks that include this file
+#ifndef MARKOV_NO_MAIN
 int main(int argc, char **argv) {
 	std::vector<std::string>trainData{"abingdon", "accrington", "acle", "acton", "adlington", "alcester", "aldeburgh",
 		"aldershot", "alford", "alfreton", "alnwick", "alsager", "alston", "alton", "altrincham", "amble", "ambleside",
@@ -388,7 +3657,18 @@ int main(int argc, char **argv) {
 
 	// prior should be between 0.001 and 0.05 if you want to enable it and add more randomness
 	double prior = 0.00;
-	WordGenerator generator(trainData, 3, prior);
+	WordGenerator generator;
+	if (argc > 1) {
+		// one word per line of a file, or of stdin with "-"
+		const std::string path = argv[1];
+		if (path == "-") {
+			generator.train(std::cin, 3, prior);
+		} else {
+			generator.trainFile(path, 3, prior);
+		}
+	} else {
+		generator.train(trainData, 3, prior);
+	}
 	WordGenerator generator2(generator.exportData());
 	WordGenerator generator3(generator);
 	//std::cout << model_to_literal(generator);
@@ -399,3 +3679,4 @@ int main(int argc, char **argv) {
 	//*/
 	return 0;
 }
+#endif
@@ -0,0 +1,55 @@
+// Generating words into a reused string must not allocate once the
+// string has grown to the longest word, see WordGenerator::newWord
+
+#include <cstdlib>
+#include <new>
+
+static size_t g_allocations = 0;
+
+void *operator new(std::size_t size) {
+	++g_allocations;
+	if (void *p = std::malloc(size ? size : 1)) {
+		return p;
+	}
+	throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept {
+	std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept {
+	std::free(p);
+}
+
+#define MARKOV_NO_MAIN
+#include "../main.cpp"
+
+static bool check(const char *name, WordGenerator &generator) {
+	Random random(1);
+	std::string word;
+	word.reserve(64);
+	for (int i = 0; i < 100; i++) {
+		generator.newWord(word, 3, 8, random);
+	}
+	const size_t before = g_allocations;
+	for (int i = 0; i < 100000; i++) {
+		generator.newWord(word, 3, 8, random);
+	}
+	const size_t allocations = g_allocations - before;
+	std::cout << name << ": " << allocations << " allocations" << std::endl;
+	return allocations == 0;
+}
+
+int main() {
+	const std::vector<std::string> words{"abingdon", "accrington", "acle", "acton", "adlington",
+		"alcester", "aldeburgh", "alnwick", "amersham", "ampthill", "andover", "appleby"};
+	bool ok = true;
+	for (const double prior : {0.0, 0.01}) {
+		WordGenerator generator(words, 3, prior);
+		ok &= check(prior > 0.0 ? "prior" : "no prior", generator);
+		generator.freeze();
+		ok &= check(prior > 0.0 ? "frozen, prior" : "frozen", generator);
+	}
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,48 @@
+// newWords returns Partial with every word of the window when the model
+// has fewer than the words asked for, and Complete otherwise
+
+#include <set>
+
+#define MARKOV_NO_MAIN
+#include "../main.cpp"
+
+static bool check(const char *name, const WordGenerator &generator, const size_t n,
+				  const int minLength, const int maxLength, const BatchStatus expected,
+				  const size_t words)
+{
+	Random random(5);
+	WordBatch batch;
+	const BatchStatus status = generator.newWords(batch, n, minLength, maxLength, random);
+	std::set<std::string_view> distinct;
+	for (size_t i = 0; i < batch.size(); ++i) {
+		distinct.insert(batch[i]);
+	}
+	const bool ok = status == expected && batch.size() == words && distinct.size() == words;
+	std::cout << name << ": " << batch.size() << " words, "
+			  << (status == BatchStatus::Complete ? "complete" : "partial") << std::endl;
+	return ok;
+}
+
+int main() {
+	bool ok = true;
+	// a single word of length 3
+	WordGenerator single(std::vector<std::string>{"abc"}, 2, 0.0);
+	ok &= check("single", single, 5, 3, 3, BatchStatus::Partial, 1);
+	ok &= check("single, enough", single, 1, 3, 3, BatchStatus::Complete, 1);
+	ok &= check("empty window", single, 5, 4, 6, BatchStatus::Partial, 0);
+
+	// with a prior every string of the alphabet is a word: "a" and "aa"
+	WordGenerator prior(std::vector<std::string>{"a"}, 1, 0.5);
+	ok &= check("prior", prior, 3, 1, 2, BatchStatus::Partial, 2);
+
+	// the 64 pairs of 8 letters
+	std::vector<std::string> words;
+	for (char a = 'a'; a <= 'h'; a++) {
+		for (char b = 'a'; b <= 'h'; b++) {
+			words.push_back(std::string(1, a) + b);
+		}
+	}
+	WordGenerator pairs(words, 1, 0.0);
+	ok &= check("pairs", pairs, 5000, 2, 2, BatchStatus::Partial, 64);
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,52 @@
+// A batch of words only depends on the seed, not on the threads that
+// generate it, see WordGenerator::newWords
+
+#define MARKOV_NO_MAIN
+#include "../main.cpp"
+
+static std::vector<std::string> corpus() {
+	Random random(7);
+	std::vector<std::string> words;
+	for (int i = 0; i < 20000; i++) {
+		std::string word;
+		const int length = 3 + random() % 8;
+		for (int j = 0; j < length; j++) {
+			word += static_cast<char>('a' + random() % 12);
+		}
+		words.push_back(word);
+	}
+	return words;
+}
+
+static bool check(const char *name, WordGenerator &generator, const size_t n,
+				  const int minLength, const int maxLength, const bool repeat)
+{
+	std::vector<std::string> first;
+	bool ok = true;
+	for (const unsigned threads : {1u, 3u, 8u, 0u}) {
+		generator.setThreads(threads);
+		generator.seed(42);
+		const std::vector<std::string> words = generator.newWords(n, minLength, maxLength, repeat);
+		if (first.empty()) {
+			first = words;
+		}
+		ok &= words.size() == n && words == first;
+	}
+	std::cout << name << ": " << (ok ? "same" : "different") << " batches" << std::endl;
+	return ok;
+}
+
+int main() {
+	const std::vector<std::string> words = corpus();
+	bool ok = true;
+	for (const double prior : {0.0, 0.01}) {
+		WordGenerator generator(words, 4, prior);
+		ok &= check("repeats", generator, 20000, 3, 9, true);
+		ok &= check("distinct", generator, 20000, 3, 9, false);
+		// the chain sampler of newWords, with lengths of a table
+		ok &= check("window", generator, 10000, 9, 10, false);
+		generator.freeze();
+		ok &= check("frozen", generator, 20000, 3, 9, false);
+	}
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,86 @@
+// Every way of training counts the same words into the same chains: a
+// vector, a stream, a mapped file, and words added after training
+
+#define MARKOV_NO_MAIN
+#include "../main.cpp"
+
+static std::vector<std::string> corpus() {
+	Random random(3);
+	std::vector<std::string> words;
+	for (int i = 0; i < 30000; i++) {
+		std::string word;
+		const int length = 2 + random() % 9;
+		for (int j = 0; j < length; j++) {
+			// the later words bring letters the first ones don't have
+			word += static_cast<char>('a' + random() % (i < 15000 ? 10 : 20));
+		}
+		words.push_back(word);
+	}
+	return words;
+}
+
+static bool sameChains(const ExportedModel &a, const ExportedModel &b) {
+	if (a.alphabet != b.alphabet || a.models.size() != b.models.size()) {
+		return false;
+	}
+	for (size_t order = 0; order < a.models.size(); ++order) {
+		if (a.models[order].size() != b.models[order].size()) {
+			return false;
+		}
+		for (const auto &it : a.models[order]) {
+			auto other = b.models[order].find(it.first);
+			if (other == b.models[order].cend()
+				|| it.second.counts(a.alphabet.size()) != other->second.counts(a.alphabet.size()))
+			{
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+static bool check(const char *name, const WordGenerator &generator, const ExportedModel &expected) {
+	const bool ok = sameChains(generator.exportData(), expected);
+	std::cout << name << ": " << (ok ? "same" : "different") << " counts" << std::endl;
+	return ok;
+}
+
+int main() {
+	const std::vector<std::string> words = corpus();
+	const std::string path = std::filesystem::temp_directory_path()
+			/ ("markov_train_check_" + std::to_string(::getpid()) + ".txt");
+	{
+		std::ofstream file(path);
+		for (const std::string &word : words) {
+			file << word << '\n';
+		}
+	}
+
+	WordGenerator serial;
+	serial.setThreads(1);
+	serial.train(words, 4);
+	const ExportedModel expected = serial.exportData();
+	bool ok = true;
+
+	WordGenerator parallel;
+	parallel.setThreads(4);
+	parallel.train(words, 4);
+	ok &= check("threads", parallel, expected);
+
+	WordGenerator stream;
+	std::ifstream input(path);
+	stream.train(input, 4);
+	ok &= check("stream", stream, expected);
+
+	WordGenerator mapped;
+	mapped.train(MappedCorpus(path), 4);
+	ok &= check("mmap", mapped, expected);
+
+	WordGenerator added;
+	added.train(std::vector<std::string>(words.begin(), words.begin() + 10000), 4);
+	added.addWords(std::vector<std::string>(words.begin() + 10000, words.end()));
+	ok &= check("addWords", added, expected);
+
+	std::filesystem::remove(path);
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}